@@ -90,11 +90,28 @@ time_t interval_secs_from(const struct timespec* base, const struct tm* interval
 	return mktime(&now);
 }
 
+struct timespec* virtual_now = NULL;
+
+void getnow(struct timespec* now) {
+	if(virtual_now) {
+		*now = *virtual_now;
+	} else {
+		clock_gettime(CLOCK_REALTIME,now);
+	}
+}
+
 void calendar_init(void) {
 	buf = malloc(0x100);
 	len = 0x100;
 }
 
+bool interval_empty(const struct tm* interval) {
+	#define ONE(what,name) if(interval->tm_ ## what) return false;
+	FOR_TM;
+	#undef ONE
+	return true;
+}
+
 void interval_between(struct tm* dest, const struct tm* a, const struct tm* b) {
 	#define ONE(what,name) dest->tm_ ## what = (a->tm_ ## what + b->tm_ ## what) / 2
 	FOR_TM;
@@ -108,9 +125,9 @@ void interval_mul(struct tm* dest, const struct tm* a, const float factor) {
 }
 
 void timespecadd(struct timespec* dest, const struct timespec* a, const struct timespec* b) {
-  dest->tv_sec += a->tv_sec + b->tv_sec;
+  dest->tv_sec = a->tv_sec + b->tv_sec;
   dest->tv_nsec = a->tv_nsec + b->tv_nsec;
-  if(dest->tv_nsec > 1000000000) {
+  if(dest->tv_nsec >= 1000000000) {
 		dest->tv_sec += dest->tv_nsec / 1000000000;
 		dest->tv_nsec %= 1000000000;
   }
@@ -27,6 +27,13 @@ time_t interval_secs(const struct tm* interval);
 time_t interval_secs_from(const struct timespec* base, const struct tm* interval);
 
 void calendar_init(void);
+
+/* the clock the scheduler runs on. Normally CLOCK_REALTIME, but when
+	 virtual_now is set (simulations) time only moves when someone advances it. */
+extern struct timespec* virtual_now;
+void getnow(struct timespec* now);
+
+bool interval_empty(const struct tm* interval);
 void interval_between(struct tm* dest, const struct tm* a, const struct tm* b);
 void interval_mul(struct tm* dest, const struct tm* a, const float factor);
 
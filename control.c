@@ -0,0 +1,256 @@
+#define _GNU_SOURCE
+#include "control.h"
+#include "queue.h"
+#include "sources.h" // sets
+#include "uring.h" // uring_forget
+#include "parse.h" // parse_interval_r
+#include "errors.h"
+#include <sys/socket.h>
+#include <sys/un.h>
+#include <unistd.h> // unlink
+#include <string.h>
+#include <stdlib.h> // qsort
+#include <stdio.h>
+#include <errno.h>
+#include <stdarg.h>
+
+static int listening = -1;
+// only one client at a time, the others wait in the backlog
+static int client = -1;
+static char request[0x200];
+static size_t have = 0;
+/* replies not yet taken by the client. The socket doesn't block, so one that
+	 isn't reading just has them pile up here, until there are too many. */
+static char* reply = NULL;
+static size_t replied = 0, sent = 0, space = 0;
+#define REPLY_MAX (1<<20)
+
+static void say(const char* fmt, ...) __attribute__((format(printf,1,2)));
+static void say(const char* fmt, ...) {
+	va_list args;
+	va_start(args,fmt);
+	int len = vsnprintf(NULL,0,fmt,args);
+	va_end(args);
+	if(len < 0) return;
+	if(replied + len + 1 > space) {
+		space = replied + len + 1 + 0x1000;
+		reply = realloc(reply,space);
+	}
+	va_start(args,fmt);
+	vsnprintf(reply+replied,len+1,fmt,args);
+	va_end(args);
+	replied += len;
+}
+
+void control_init(const char* path) {
+	const char* env = getenv("control");
+	if(env) path = env;
+	if(path == NULL) return;
+	struct sockaddr_un addr = { .sun_family = AF_UNIX };
+	if(strlen(path) >= sizeof(addr.sun_path)) {
+		warn("control socket path %s is too long",path);
+		return;
+	}
+	strcpy(addr.sun_path,path);
+	listening = socket(AF_UNIX,SOCK_STREAM|SOCK_NONBLOCK|SOCK_CLOEXEC,0);
+	assert(listening >= 0);
+	if(0 == connect(listening,(struct sockaddr*)&addr,sizeof(addr))) {
+		warn("another daemon is listening on %s",path);
+		close(listening);
+		listening = -1;
+		return;
+	}
+	// nobody's there, so it's left over from a daemon that died
+	unlink(path);
+	if(0 != bind(listening,(struct sockaddr*)&addr,sizeof(addr)) ||
+		 0 != listen(listening,8)) {
+		warn("couldn't listen on %s",path);
+		close(listening);
+		listening = -1;
+	}
+}
+
+void control_fds(struct pollfd fds[2]) {
+	// stop accepting while someone's connected
+	fds[0].fd = client < 0 ? listening : -1;
+	fds[0].events = POLLIN;
+	fds[1].fd = client;
+	fds[1].events = POLLIN;
+	// until it's taken everything we said
+	if(sent < replied) fds[1].events |= POLLOUT;
+}
+
+static void hang_up(void) {
+	if(uring) uring_forget(client);
+	close(client);
+	client = -1;
+	have = 0;
+	replied = sent = 0;
+}
+
+static void drain(void) {
+	while(sent < replied) {
+		// and no SIGPIPE if it hung up
+		ssize_t amt = send(client,reply+sent,replied-sent,MSG_NOSIGNAL);
+		if(amt < 0) {
+			if(errno == EINTR) continue;
+			if(errno == EAGAIN) break;
+			hang_up();
+			return;
+		}
+		sent += amt;
+	}
+	if(sent == replied) {
+		replied = sent = 0;
+	} else if(replied - sent > REPLY_MAX) {
+		// stopped reading its replies
+		hang_up();
+	}
+}
+
+static bool named(const char* name, const char* what, size_t len) {
+	return strlen(name) == len && 0 == memcmp(name,what,len);
+}
+
+/* name is file/rule for rules in rules.d. The file can be as it is in the
+	 logs, rules.d%file, or the path to it, or just its name. */
+static struct rule* find(const char* name) {
+	const char* slash = strrchr(name,'/');
+	size_t nslen = slash ? slash - name : 0;
+	size_t i;
+	for(i=0;i<nsets;++i) {
+		const struct ruleset* set = sets[i];
+		const char* base = strrchr(set->path,'/');
+		base = base ? base+1 : set->path;
+		if(named(set->namespace,name,nslen) ||
+			 (slash && (named(set->path,name,nslen) || named(base,name,nslen)))) {
+			struct rule* r = ruleset_find(sets[i],slash ? slash+1 : name);
+			if(r) return r;
+		}
+	}
+	return NULL;
+}
+
+static int by_due(const void* a, const void* b) {
+	const struct timespec* x = &(*(struct rule**)a)->due;
+	const struct timespec* y = &(*(struct rule**)b)->due;
+	if(timespecequal(x,y)) return 0;
+	return timespecbefore(x,y) ? -1 : 1;
+}
+
+static void list(void) {
+	struct rule** sorted = malloc(queue_num * sizeof(*sorted));
+	memcpy(sorted,queue,queue_num * sizeof(*sorted));
+	qsort(sorted,queue_num,sizeof(*sorted),by_due);
+	size_t i;
+	for(i=0;i<queue_num;++i) {
+		struct rule* r = sorted[i];
+		const char* state = "waiting";
+		if(r->running) {
+			state = "running";
+		} else if(r->disabled) {
+			state = "paused";
+		} else if(r->triggered) {
+			state = "after";
+		}
+		if(r->due.tv_sec == NEVER) {
+			say("%s\t%s\tnever\n",rule_name(r),state);
+		} else {
+			say("%s\t%s\t%s\n",rule_name(r),state,myctime(r->due.tv_sec));
+		}
+	}
+	free(sorted);
+}
+
+static const char* command(char* line) {
+	char* save = NULL;
+	const char* verb = strtok_r(line," \t",&save);
+	if(verb == NULL) return NULL;
+	if(0 == strcmp(verb,"list")) {
+		list();
+		return NULL;
+	}
+	const char* name = strtok_r(NULL," \t",&save);
+	if(name == NULL) return "which rule?";
+	struct rule* r = find(name);
+	if(r == NULL) return "no such rule";
+	struct timespec now;
+	getnow(&now);
+	if(0 == strcmp(verb,"run")) {
+		if(r->disabled) return "it's paused";
+		queue_trigger(r,&now);
+	} else if(0 == strcmp(verb,"pause")) {
+		r->disabled = true;
+		// if it's running, it gets parked when it finishes
+		if(!r->running) queue_park(r);
+	} else if(0 == strcmp(verb,"resume")) {
+		if(!r->disabled) return "it isn't paused";
+		r->disabled = false;
+		if(!r->running && !r->triggered) {
+			rule_next_due(r,&now,false);
+			rule_save_due(r);
+			queue_adjust(r);
+		}
+	} else if(0 == strcmp(verb,"shift")) {
+		// the rest of the line
+		char* amount = save;
+		while(*amount == ' ' || *amount == '\t') ++amount;
+		bool sooner = *amount == '-';
+		if(sooner) ++amount;
+		struct tm by;
+		const char* problem = NULL;
+		if(*amount == '\0') return "shift it by how much?";
+		if(!parse_interval_r(&by,amount,strlen(amount),&problem)) return problem;
+		if(r->due.tv_sec == NEVER) return "it isn't scheduled";
+		if(sooner) interval_mul(&by,&by,-1);
+		struct tm date;
+		localtime_r(&r->due.tv_sec,&date);
+		advance_interval(&date,&by);
+		date.tm_isdst = -1;
+		r->due.tv_sec = mktime(&date);
+		rule_save_due(r);
+		queue_adjust(r);
+	} else {
+		return "unknown command";
+	}
+	say("%s %s\n",verb,rule_name(r));
+	return NULL;
+}
+
+static void serve(void) {
+	ssize_t amt = read(client,request+have,sizeof(request)-have);
+	if(amt <= 0) {
+		if(amt < 0 && errno == EAGAIN) return;
+		hang_up();
+		return;
+	}
+	have += amt;
+	char* line = request;
+	char* nl;
+	while((nl = memchr(line,'\n',have - (line-request)))) {
+		*nl = '\0';
+		const char* problem = command(line);
+		if(problem) say("error: %s\n",problem);
+		line = nl+1;
+	}
+	have -= line-request;
+	memmove(request,line,have);
+	if(have == sizeof(request)) {
+		say("error: too long\n");
+		have = 0;
+	}
+	drain();
+}
+
+void control_ready(const struct pollfd fds[2]) {
+	if(client >= 0 && (fds[1].revents & POLLOUT)) {
+		drain();
+	}
+	if(client >= 0 && (fds[1].revents & ~POLLOUT)) {
+		serve();
+	}
+	if(client < 0 && fds[0].fd >= 0 && (fds[0].revents & POLLIN)) {
+		// never blocks, so a client that never reads can't hold up the daemon
+		client = accept4(listening,NULL,NULL,SOCK_CLOEXEC|SOCK_NONBLOCK);
+	}
+}
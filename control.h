@@ -0,0 +1,26 @@
+#ifndef CONTROL_H
+#define CONTROL_H
+
+#include <poll.h>
+
+/* a unix socket for poking at the daemon without editing any rules. It's
+	 ~/.config/regularly/control, or wherever the control environment variable
+	 says. Connect (socat - UNIX-CONNECT:control) and send one command per line:
+
+	 list                 every rule, soonest first, with when it's due
+	 run <rule>           run it now
+	 pause <rule>         don't run it until it's resumed
+	 resume <rule>        run it one interval from now
+	 shift <rule> <when>  move when it's due by an interval, -1h for sooner
+
+	 rules in rules.d are <file>/<name>. Each command is one queue adjustment,
+	 and none survive the rule's file being edited. */
+
+// path may be NULL, for no socket unless the environment asks for one
+void control_init(const char* path);
+// the two descriptors to wait on. Negative ones aren't in use.
+void control_fds(struct pollfd fds[2]);
+// handle whatever the wait turned up on them
+void control_ready(const struct pollfd fds[2]);
+
+#endif /* CONTROL_H */
@@ -3,35 +3,143 @@
 #include <stdarg.h>
 #include <errno.h>
 #include <stdlib.h>
+#include <string.h> // memcpy
+#include <strings.h> // strcasecmp
+#include <unistd.h> // write
+#include <sys/uio.h> // writev
+
+enum log_level log_level = LOG_INFO;
+
+// must be a power of 2
+#define RING_SIZE 0x10000
+#define LOG_LINE_MAX 0x400
+
+static char ring[RING_SIZE];
+// head and tail only ever increase, so head-tail is the amount pending
+static size_t head = 0, tail = 0;
+// tail <= sent <= head, and tail..sent is being written by someone else
+static size_t sent = 0;
+
+void (*log_wait)(void) = NULL;
+
+static int segments(struct iovec io[2]) {
+	size_t start = tail & (RING_SIZE-1);
+	size_t pending = head - tail;
+	io[0].iov_base = ring + start;
+	io[0].iov_len = pending;
+	if(start + pending <= RING_SIZE) return 1;
+	// wrapped around the end
+	io[0].iov_len = RING_SIZE - start;
+	io[1].iov_base = ring;
+	io[1].iov_len = pending - io[0].iov_len;
+	return 2;
+}
+
+void log_flush(void) {
+	if(sent != tail && log_wait) {
+		// can't write those bytes again, or write after them yet
+		log_wait();
+	}
+	while(tail != head) {
+		struct iovec io[2];
+		int nio = segments(io);
+		ssize_t amt = writev(STDERR_FILENO, io, nio);
+		if(amt < 0) {
+			if(errno == EINTR) continue;
+			// nowhere to complain to, so just drop it
+			tail = head;
+			break;
+		}
+		tail += amt;
+	}
+	sent = tail;
+}
+
+int log_take(struct iovec* io) {
+	if(sent != tail || tail == head) return 0;
+	sent = head;
+	return segments(io);
+}
+
+void log_written(ssize_t amt) {
+	if(amt < 0) {
+		tail = sent;
+	} else {
+		// anything short gets taken again next time
+		tail += amt;
+	}
+	sent = tail;
+}
+
+static void ring_put(const char* s, size_t len) {
+	if(head - tail + len > RING_SIZE) {
+		log_flush();
+	}
+	size_t start = head & (RING_SIZE-1);
+	size_t first = RING_SIZE - start;
+	if(first >= len) {
+		memcpy(ring+start, s, len);
+	} else {
+		memcpy(ring+start, s, first);
+		memcpy(ring, s+first, len-first);
+	}
+	head += len;
+}
+
+static void log_vwrite(enum log_level level, const char* s, va_list args) {
+	static const char* prefixes[] = {
+		[LOG_INFO] = "",
+		[LOG_WARN] = "WARNING: ",
+		[LOG_ERROR] = "ERROR: "
+	};
+	char line[LOG_LINE_MAX];
+	size_t plen = strlen(prefixes[level]);
+	memcpy(line,prefixes[level],plen);
+	int amt = vsnprintf(line+plen,LOG_LINE_MAX-plen-1,s,args);
+	if(amt < 0) return;
+	size_t len = plen + amt;
+	if(len > LOG_LINE_MAX-2) {
+		// truncated
+		len = LOG_LINE_MAX-2;
+	}
+	line[len++] = '\n';
+	ring_put(line,len);
+}
+
+void log_write(enum log_level level, const char* s, ...) {
+	if(level < log_level) return;
+	va_list args;
+	va_start(args,s);
+	log_vwrite(level,s,args);
+	va_end(args);
+}
+
+void log_init(void) {
+	const char* level = getenv("loglevel");
+	if(level) {
+		if(0==strcasecmp(level,"info")) {
+			log_level = LOG_INFO;
+		} else if(0==strcasecmp(level,"warn")) {
+			log_level = LOG_WARN;
+		} else if(0==strcasecmp(level,"error")) {
+			log_level = LOG_ERROR;
+		} else {
+			warn("unknown loglevel %s",level);
+		}
+	}
+	atexit(log_flush);
+}
 
 void error(const char* s, ...) {
-  va_list args;
-  fputs("ERROR: ",stderr);
-  va_start(args,s);
-  vfprintf(stderr,s, args);
-  va_end(args);
-  fputc('\n',stderr);
-  if(errno) {
-	perror("Errno:");
-  }
-  exit(23);
-}
-
-void warn(const char* s, ...) {
-  va_list args;
-  fputs("WARNING: ",stderr);
-  va_start(args,s);
-  vfprintf(stderr,s, args);
-  va_end(args);
-  putchar('\n');
-}
-
-#ifndef SILENT_INFO
-void info(const char* s, ...) {
-  va_list args;
-  va_start(args,s);
-  vfprintf(stderr,s, args);
-  va_end(args);
-  putchar('\n');
-}
-#endif
+	int err = errno;
+	va_list args;
+	va_start(args,s);
+	log_vwrite(LOG_ERROR,s,args);
+	va_end(args);
+	log_flush();
+	if(err) {
+		errno = err;
+		perror("Errno:");
+	}
+	exit(23);
+}
@@ -1,13 +1,52 @@
-void error(const char* s, ...);
-void warn(const char* s, ...);
+#ifndef ERRORS_H
+#define ERRORS_H
+
+#include <stdbool.h>
+#include <sys/types.h> // ssize_t
+
+/* log messages are formatted into a ring buffer and only written out by
+	 log_flush(), which the main loop calls when it's idle (right before ppoll).
+	 The daemon is single threaded, so the ring needs no locking.
+
+	 Levels below log_level are dropped at runtime before any formatting happens,
+	 and with SILENT_INFO info() call sites compile to nothing at all.
+*/
+
+enum log_level { LOG_INFO, LOG_WARN, LOG_ERROR };
+extern enum log_level log_level;
+
+// reads the loglevel environment variable (info, warn or error)
+void log_init(void);
+void log_flush(void);
+
+/* for writing the log asynchronously: log_take hands out what's pending (at
+	 most one batch at a time) and log_written says how much of it went out.
+	 log_flush calls log_wait first if a batch is still out. */
+struct iovec;
+int log_take(struct iovec* io);
+void log_written(ssize_t amt);
+extern void (*log_wait)(void);
+void log_write(enum log_level level, const char* s, ...)
+	__attribute__((format(printf,2,3)));
+
+void error(const char* s, ...)
+	__attribute__((format(printf,1,2), noreturn));
+
+#define warn(...) do {													\
+		if(log_level <= LOG_WARN) log_write(LOG_WARN,__VA_ARGS__);	\
+	} while(0)
 
 #ifdef SILENT_INFO
 #define info(...)
 #else
-void info(const char* s, ...);
+#define info(...) do {													\
+		if(log_level <= LOG_INFO) log_write(LOG_INFO,__VA_ARGS__);	\
+	} while(0)
 #endif
 
 #define assert_equal(a,b) if((a) != (b)) { error(#a " != " #b " %d %d\n",(a),(b)); exit(1); }
 #define assert_zero(a) assert_equal(a,0);
 
-#define assert(a) if(!(a)) { error("assert failed: " #a); }
+#define assert(a) if(!(a)) { error("assert failed: %s", #a); }
+
+#endif /* ERRORS_H */
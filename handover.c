@@ -0,0 +1,278 @@
+#define _GNU_SOURCE
+#include "handover.h"
+#include "sources.h" // sets
+#include "queue.h"
+#include "jobs.h"
+#include "lease.h"
+#include "uring.h" // uring_drain
+#include "errors.h"
+#include <sys/mman.h> // memfd_create
+#include <sys/stat.h> // fstat
+#include <fcntl.h> // fcntl
+#include <unistd.h> // execvp
+#include <string.h>
+#include <stdlib.h> // realpath, setenv
+#include <stdio.h>
+#include <errno.h>
+
+#define MAGIC 0x72656775
+#define VERSION 2
+// which descriptor the state is in
+#define ENV "regularly_handover"
+
+volatile sig_atomic_t handover_wanted = 0;
+
+static char** args = NULL;
+static char* exe = NULL;
+
+// what the last image left us
+static char* state = NULL;
+static size_t state_size = 0;
+
+struct header {
+	uint32_t magic;
+	uint32_t version;
+	uint32_t num;
+	int32_t member;
+};
+
+/* one per rule, and one per running job whose rule went away. Its namespace
+	 then its name (or command, if it has no name) follow it. */
+struct handed {
+	struct timespec due;
+	struct tm interval;
+	uint64_t fingerprint;
+	// the job running it, if pid isn't 0
+	struct timespec job_due;
+	struct timespec started;
+	int32_t pid;
+	int32_t lease;
+	// the job's inputs check, -1 if none
+	int32_t check;
+	uint16_t nslen;
+	uint16_t keylen;
+	uint8_t retried;
+	bool named;
+	bool orphan;
+	bool disabled;
+	bool retrigger;
+	bool fingerprinted;
+};
+
+#define ALIGNED(n) (((n) + 7) & ~(size_t)7)
+
+static void onhup(int signal) {
+	handover_wanted = 1;
+}
+
+void handover_init(char* argv[]) {
+	args = argv;
+	// we're about to chdir, and the binary may be replaced by then
+	if(strchr(argv[0],'/')) exe = realpath(argv[0],NULL);
+	if(exe == NULL) exe = strdup(argv[0]);
+	struct sigaction act = {
+		.sa_handler = onhup
+	};
+	sigemptyset(&act.sa_mask);
+	sigaction(SIGHUP,&act,NULL);
+
+	const char* env = getenv(ENV);
+	if(env == NULL) return;
+	int fd = atoi(env);
+	unsetenv(ENV);
+	struct stat info;
+	if(0 == fstat(fd,&info) && info.st_size >= sizeof(struct header)) {
+		state_size = info.st_size;
+		state = mmap(NULL,state_size,PROT_READ,MAP_PRIVATE,fd,0);
+		if(state == MAP_FAILED) state = NULL;
+	}
+	close(fd);
+	const struct header* h = (const struct header*)state;
+	if(state && (h->magic != MAGIC || h->version != VERSION)) {
+		warn("can't read the state a different version left, starting over");
+		munmap(state,state_size);
+		state = NULL;
+	}
+}
+
+int handover_member(void) {
+	if(state == NULL) return -1;
+	return ((const struct header*)state)->member;
+}
+
+static struct rule* find(const char* ns, size_t nslen,
+												 const char* key, size_t keylen, bool named) {
+	size_t i, j;
+	char* k = strndup(key,keylen);
+	struct rule* found = NULL;
+	for(i=0;i<nsets;++i) {
+		struct ruleset* set = sets[i];
+		if(strlen(set->namespace) != nslen || 0 != memcmp(set->namespace,ns,nslen))
+			continue;
+		if(named) {
+			found = ruleset_find(set,k);
+		} else {
+			for(j=0;j<set->num;++j) {
+				if(set->rules[j].name == NULL &&
+					 0 == strcmp(rule_command(set->rules+j),k)) {
+					found = set->rules + j;
+					break;
+				}
+			}
+		}
+		break;
+	}
+	free(k);
+	return found;
+}
+
+bool handover_restore(void) {
+	if(state == NULL) return false;
+	const struct header* h = (const struct header*)state;
+	size_t offset = sizeof(*h), i, restored = 0, running = 0;
+	for(i=0;i<h->num && offset + sizeof(struct handed) <= state_size;++i) {
+		const struct handed* hd = (const struct handed*)(state + offset);
+		const char* ns = state + offset + sizeof(*hd);
+		const char* key = ns + hd->nslen;
+		offset += ALIGNED(sizeof(*hd) + hd->nslen + hd->keylen);
+		struct rule* r = NULL;
+		if(!hd->orphan) r = find(ns,hd->nslen,key,hd->keylen,hd->named);
+		if(hd->pid) {
+			// still ours, so it gets reaped even if its rule is gone
+			if(hd->check >= 0) fcntl(hd->check,F_SETFD,FD_CLOEXEC);
+			job_adopt(r,hd->pid,hd->check,&hd->job_due,&hd->started);
+			++running;
+		}
+		if(r == NULL) {
+			if(hd->lease >= 0) close(hd->lease);
+			continue;
+		}
+		r->due = hd->due;
+		r->interval = hd->interval;
+		r->retried = hd->retried;
+		r->disabled = hd->disabled;
+		r->retrigger = hd->retrigger;
+		r->fingerprint = hd->fingerprint;
+		r->fingerprinted = hd->fingerprinted;
+		if(hd->lease >= 0) {
+			r->lease = hd->lease;
+			fcntl(r->lease,F_SETFD,FD_CLOEXEC);
+		}
+		queue_adjust(r);
+		++restored;
+	}
+	munmap(state,state_size);
+	state = NULL;
+	warn("picked up where we left off: %zu rules, %zu running",restored,running);
+	return true;
+}
+
+static struct job* job_of(const struct rule* r) {
+	size_t i;
+	for(i=0;i<jobs_num;++i) {
+		if(jobs[i].rule == r) return jobs + i;
+	}
+	return NULL;
+}
+
+static void put(FILE* out, struct handed* hd, const char* ns, const char* key) {
+	static const char zeros[8] = {};
+	hd->nslen = strlen(ns);
+	hd->keylen = strlen(key);
+	fwrite(hd,sizeof(*hd),1,out);
+	fwrite(ns,hd->nslen,1,out);
+	fwrite(key,hd->keylen,1,out);
+	size_t len = sizeof(*hd) + hd->nslen + hd->keylen;
+	fwrite(zeros,ALIGNED(len) - len,1,out);
+}
+
+// the lease and check descriptors have to survive the exec, or else not
+static void keep(int fd, bool keep) {
+	if(fd >= 0) fcntl(fd,F_SETFD,keep ? 0 : FD_CLOEXEC);
+}
+
+static void keep_fds(bool yes) {
+	size_t i, j;
+	for(i=0;i<jobs_num;++i) {
+		keep(jobs[i].check,yes);
+	}
+	if(!leasing) return;
+	keep(lease_member(),yes);
+	for(i=0;i<nsets;++i) {
+		for(j=0;j<sets[i]->num;++j) {
+			keep(sets[i]->rules[j].lease,yes);
+		}
+	}
+}
+
+void handover(void) {
+	handover_wanted = 0;
+	int fd = memfd_create("regularly",MFD_CLOEXEC);
+	if(fd < 0) {
+		warn("couldn't make a memfd to re-execute with");
+		return;
+	}
+	FILE* out = fdopen(fcntl(fd,F_DUPFD_CLOEXEC,0),"w");
+	struct header h = {
+		.magic = MAGIC,
+		.version = VERSION,
+		.member = leasing ? lease_member() : -1
+	};
+	fwrite(&h,sizeof(h),1,out);
+	size_t i, j;
+	for(i=0;i<nsets;++i) {
+		for(j=0;j<sets[i]->num;++j) {
+			struct rule* r = sets[i]->rules + j;
+			struct job* job = r->running ? job_of(r) : NULL;
+			struct handed hd = {
+				.due = r->due,
+				.interval = r->interval,
+				.fingerprint = r->fingerprint,
+				.pid = job ? job->pid : 0,
+				.job_due = job ? job->due : (struct timespec){},
+				.started = job ? job->started : (struct timespec){},
+				.lease = r->lease,
+				.check = job ? job->check : -1,
+				.retried = r->retried,
+				.named = r->name != NULL,
+				.disabled = r->disabled,
+				.retrigger = r->retrigger,
+				.fingerprinted = r->fingerprinted
+			};
+			put(out,&hd,sets[i]->namespace,r->name ? r->name : rule_command(r));
+			++h.num;
+		}
+	}
+	for(i=0;i<jobs_num;++i) {
+		if(jobs[i].rule) continue;
+		struct handed hd = {
+			.pid = jobs[i].pid,
+			.job_due = jobs[i].due,
+			.started = jobs[i].started,
+			.lease = -1,
+			.check = jobs[i].check,
+			.orphan = true
+		};
+		put(out,&hd,"","");
+		++h.num;
+	}
+	fclose(out);
+	pwrite(fd,&h,sizeof(h),0);
+
+	warn("re-executing %s",exe);
+	// nothing half written
+	if(uring) uring_drain();
+	log_flush();
+	keep_fds(true);
+	// only the new image gets it, not whatever's running
+	keep(fd,true);
+	char num[0x10];
+	snprintf(num,sizeof(num),"%d",fd);
+	setenv(ENV,num,1);
+	execvp(exe,args);
+
+	warn("couldn't re-execute %s: %s",exe,strerror(errno));
+	unsetenv(ENV);
+	keep_fds(false);
+	close(fd);
+}
@@ -0,0 +1,27 @@
+#ifndef HANDOVER_H
+#define HANDOVER_H
+
+#include <signal.h>
+#include <stdbool.h>
+
+/* kill -HUP makes the daemon re-execute itself, to pick up a new binary
+	 without losing anything. Everything the rules files don't say (due times,
+	 retry counts, slowed down intervals, paused rules, input fingerprints, and
+	 which rules are running as which pids) is written into a memfd, which the new
+	 image reads back once it has loaded the rules. Running commands stay our
+	 children through the exec, so they're reaped like nothing happened, and
+	 their leases stay locked, and what they find checking their inputs still
+	 arrives, because those descriptors are kept open. */
+
+extern volatile sig_atomic_t handover_wanted;
+
+// before anything else. Remembers how to exec ourselves, and looks for state
+void handover_init(char* argv[]);
+// the membership lock an earlier image left us, or -1
+int handover_member(void);
+// put the state back, once the rules are loaded. True if there was any
+bool handover_restore(void);
+// exec ourselves. Only returns if that failed
+void handover(void);
+
+#endif /* HANDOVER_H */
@@ -0,0 +1,301 @@
+#define _GNU_SOURCE
+#define JOURNAL_TOOL
+#include "journal.h"
+#include "parse.h" // parse_interval
+#include "errors.h"
+#include <sys/mman.h> // mmap
+#include <sys/stat.h> // fstat
+#include <sys/wait.h> // WIFEXITED etc
+#include <fcntl.h> // openat
+#include <unistd.h> // getopt
+#include <stdio.h>
+#include <string.h>
+#include <stdlib.h> // qsort
+#include <pwd.h>
+
+/* regularly-history [-d dir] [-s since] [-r rule] [-f]
+
+	 summarizes the runs in the history journal since some interval ago (a week
+	 by default.) -r limits it to one rule, -f lists the failures instead. */
+
+struct name {
+	uint64_t id;
+	char* name;
+};
+
+static struct name* names = NULL;
+static size_t nnames = 0;
+
+static int by_u64(const void* a, const void* b) {
+	uint64_t x = *(const uint64_t*)a;
+	uint64_t y = *(const uint64_t*)b;
+	return x < y ? -1 : x > y;
+}
+
+static int by_id(const void* a, const void* b) {
+	uint64_t x = ((const struct name*)a)->id;
+	uint64_t y = ((const struct name*)b)->id;
+	return x < y ? -1 : x > y;
+}
+
+static void load_names(int dir) {
+	int fd = openat(dir,"names",O_RDONLY);
+	if(fd < 0) return;
+	FILE* in = fdopen(fd,"r");
+	char* line = NULL;
+	size_t space = 0;
+	ssize_t amt;
+	while((amt = getline(&line,&space,in)) > 18) {
+		line[amt-1] = '\0';
+		names = realloc(names,(nnames+1)*sizeof(*names));
+		names[nnames].id = strtoull(line,NULL,16);
+		names[nnames].name = strdup(line+17);
+		++nnames;
+	}
+	free(line);
+	fclose(in);
+	qsort(names,nnames,sizeof(*names),by_id);
+}
+
+static const char* name_of(uint64_t id) {
+	struct name key = { .id = id };
+	struct name* found = bsearch(&key,names,nnames,sizeof(*names),by_id);
+	if(found) return found->name;
+	static char buf[0x20];
+	snprintf(buf,sizeof(buf),"%016llx",(unsigned long long)id);
+	return buf;
+}
+
+// does part match what's in name[0..len), the way control.c's find() does?
+static bool named(const char* name, size_t len, const char* part, size_t plen) {
+	return len == plen && 0 == memcmp(name,part,len);
+}
+
+/* name as the journal has it, namespace/name for rules in rules.d, where the
+	 namespace is the file's path with / turned into %. -r can give the file
+	 that way, as its path, or as the end of its path, down to just its name. */
+static bool matches(const char* name, const char* only) {
+	if(0 == strcmp(name,only)) return true;
+	const char* slash = strrchr(only,'/');
+	const char* split = strrchr(name,'/');
+	if(slash == NULL || split == NULL || 0 != strcmp(slash+1,split+1)) return false;
+	size_t want = slash - only;
+	size_t len = split - name;
+	if(named(name,len,only,want)) return true;
+	char path[len+1];
+	size_t i;
+	for(i=0;i<len;++i) {
+		path[i] = name[i] == '%' ? '/' : name[i];
+	}
+	path[len] = '\0';
+	if(named(path,len,only,want)) return true;
+	return want < len && path[len-want-1] == '/' &&
+		0 == memcmp(path+len-want,only,want);
+}
+
+// every rule -r could mean, sorted
+static uint64_t* wanted = NULL;
+static size_t nwanted = 0;
+
+static void resolve(const char* only) {
+	// unnamed rules go by their command, which isn't a file/name at all
+	wanted = malloc((nnames+1)*sizeof(*wanted));
+	wanted[nwanted++] = journal_id(only,0);
+	size_t i;
+	for(i=0;i<nnames;++i) {
+		if(matches(names[i].name,only)) wanted[nwanted++] = names[i].id;
+	}
+	qsort(wanted,nwanted,sizeof(*wanted),by_u64);
+}
+
+static bool is_wanted(uint64_t id) {
+	return NULL != bsearch(&id,wanted,nwanted,sizeof(*wanted),by_u64);
+}
+
+static bool failed(const struct run_record* run) {
+	return !WIFEXITED(run->status) || WEXITSTATUS(run->status) != 0;
+}
+
+struct summary {
+	uint64_t rule;
+	// durations, in nanoseconds
+	int64_t* took;
+	size_t runs;
+	size_t failures;
+	int64_t late;
+	int64_t maxrss;
+};
+
+static struct summary* rules = NULL;
+static size_t nrules = 0;
+/* where each id's summary is in rules, plus one, or 0 if that slot's empty.
+	 Ids are hashes already, so they index it directly. Never more than half full */
+static size_t* slots = NULL;
+static size_t nslots = 0;
+
+static size_t* slot_for(uint64_t id) {
+	size_t i = id & (nslots-1);
+	while(slots[i] && rules[slots[i]-1].rule != id) {
+		i = (i+1) & (nslots-1);
+	}
+	return slots+i;
+}
+
+static struct summary* summary_for(uint64_t id) {
+	if(nslots) {
+		size_t found = *slot_for(id);
+		if(found) return &rules[found-1];
+	}
+	if(2*(nrules+1) > nslots) {
+		free(slots);
+		nslots = nslots ? 2*nslots : 0x100;
+		slots = calloc(nslots,sizeof(*slots));
+		size_t i;
+		for(i=0;i<nrules;++i) *slot_for(rules[i].rule) = i+1;
+	}
+	if(nrules % 0x100 == 0) {
+		rules = realloc(rules,(nrules+0x100)*sizeof(*rules));
+	}
+	memset(&rules[nrules],0,sizeof(*rules));
+	rules[nrules].rule = id;
+	*slot_for(id) = nrules+1;
+	return &rules[nrules++];
+}
+
+static void tally(const struct run_record* run) {
+	struct summary* s = summary_for(run->rule);
+	if(s->runs % 0x40 == 0) {
+		s->took = realloc(s->took,(s->runs + 0x40)*sizeof(*s->took));
+	}
+	s->took[s->runs++] = run->end - run->start;
+	if(failed(run)) ++s->failures;
+	if(run->start > run->due) s->late += run->start - run->due;
+	if(run->maxrss > s->maxrss) s->maxrss = run->maxrss;
+}
+
+static void show_failure(const struct run_record* run) {
+	time_t when = run->end / 1000000000;
+	struct tm tm;
+	char date[0x40];
+	localtime_r(&when,&tm);
+	strftime(date,sizeof(date),"%F %T",&tm);
+	if(WIFSIGNALED(run->status)) {
+		printf("%s %s died with %d (%s)\n",date,name_of(run->rule),
+					 WTERMSIG(run->status),strsignal(WTERMSIG(run->status)));
+	} else {
+		printf("%s %s exited with %d\n",date,name_of(run->rule),
+					 WEXITSTATUS(run->status));
+	}
+}
+
+static int by_duration(const void* a, const void* b) {
+	int64_t x = *(const int64_t*)a;
+	int64_t y = *(const int64_t*)b;
+	return x < y ? -1 : x > y;
+}
+
+static double percentile(const struct summary* s, int p) {
+	size_t i = (s->runs * p + 99) / 100;
+	if(i > 0) --i;
+	return s->took[i] / 1.0e9;
+}
+
+int main(int argc, char *argv[])
+{
+	log_init();
+	calendar_init();
+	const char* dir = NULL;
+	const char* only = NULL;
+	bool failures = false;
+	struct tm since = { .tm_mday = 7 };
+	int opt;
+	while((opt = getopt(argc,argv,"d:s:r:f")) != -1) {
+		switch(opt) {
+		case 'd':
+			dir = optarg;
+			break;
+		case 's':
+			parse_interval(&since,optarg,strlen(optarg));
+			break;
+		case 'r':
+			only = optarg;
+			break;
+		case 'f':
+			failures = true;
+			break;
+		default:
+			error("usage: %s [-d dir] [-s since] [-r rule] [-f]",argv[0]);
+		};
+	}
+
+	char path[0x200];
+	if(dir == NULL) {
+		struct passwd* me = getpwuid(getuid());
+		snprintf(path,sizeof(path),"%s/.config/regularly/history",me->pw_dir);
+		dir = path;
+	}
+	int history = open(dir,O_RDONLY|O_DIRECTORY);
+	if(history < 0) error("no history in %s",dir);
+	load_names(history);
+
+	// since is an interval back from now
+	struct timespec now;
+	getnow(&now);
+	struct tm start;
+	localtime_r(&now.tv_sec,&start);
+#define ONE(what) start.tm_ ## what -= since.tm_ ## what
+	ONE(sec); ONE(min); ONE(hour); ONE(mday); ONE(mon); ONE(year);
+#undef ONE
+	start.tm_isdst = -1;
+	int64_t from = mktime(&start) * INT64_C(1000000000);
+	if(only) resolve(only);
+
+	time_t day;
+	for(day = from / 1000000000 / SECS_PER_DAY;
+			day <= now.tv_sec / SECS_PER_DAY;
+			++day) {
+		struct tm date;
+		time_t midnight = day * SECS_PER_DAY;
+		gmtime_r(&midnight,&date);
+		char name[0x20];
+		strftime(name,sizeof(name),"%Y-%m-%d.runs",&date);
+		int fd = openat(history,name,O_RDONLY);
+		if(fd < 0) continue;
+		struct stat info;
+		fstat(fd,&info);
+		size_t num = info.st_size / sizeof(struct run_record);
+		if(num == 0) {
+			close(fd);
+			continue;
+		}
+		const struct run_record* runs = mmap(NULL,num*sizeof(*runs),
+																				 PROT_READ,MAP_PRIVATE,fd,0);
+		close(fd);
+		if(runs == MAP_FAILED) error("couldn't map %s",name);
+		size_t i;
+		for(i=0;i<num;++i) {
+			if(runs[i].end < from) continue;
+			if(only && !is_wanted(runs[i].rule)) continue;
+			if(failures) {
+				if(failed(&runs[i])) show_failure(&runs[i]);
+			} else {
+				tally(&runs[i]);
+			}
+		}
+		munmap((void*)runs,num*sizeof(*runs));
+	}
+	if(failures) return 0;
+
+	printf("%-32s %6s %6s %9s %9s %9s %9s %9s\n",
+				 "rule","runs","failed","p50","p90","p99","late","maxrss");
+	size_t i;
+	for(i=0;i<nrules;++i) {
+		struct summary* s = &rules[i];
+		qsort(s->took,s->runs,sizeof(*s->took),by_duration);
+		printf("%-32s %6zu %6zu %8.2fs %8.2fs %8.2fs %8.2fs %7ldkB\n",
+					 name_of(s->rule),s->runs,s->failures,
+					 percentile(s,50),percentile(s,90),percentile(s,99),
+					 s->late / 1.0e9 / s->runs,(long)s->maxrss);
+	}
+	return 0;
+}
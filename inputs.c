@@ -0,0 +1,76 @@
+#define _GNU_SOURCE
+#include "inputs.h"
+#include "journal.h" // journal_hash
+#include "errors.h"
+#include <glob.h>
+#include <sys/stat.h>
+#include <fcntl.h> // open, posix_fadvise
+#include <unistd.h> // read, close
+#include <stdlib.h> // strndup
+
+static uint64_t contents_of(const char* path, const struct stat* info, uint64_t h) {
+	if(!S_ISREG(info->st_mode) || info->st_size == 0) return h;
+	int fd = open(path,O_RDONLY|O_CLOEXEC);
+	if(fd < 0) return h;
+	/* read, not mmap, so a big input doesn't count towards the maxrss of the
+		 command that's checking it. FNV-1a hashes the same either way. */
+	posix_fadvise(fd,0,0,POSIX_FADV_SEQUENTIAL);
+	static char buf[0x10000];
+	ssize_t amt;
+	while((amt = read(fd,buf,sizeof(buf))) > 0) {
+		h = journal_hash(buf,amt,h);
+	}
+	close(fd);
+	return h;
+}
+
+static uint64_t one(const char* path, bool contents, uint64_t h) {
+	struct stat info;
+	h = journal_id(path,h);
+	if(0 != stat(path,&info)) {
+		// it's gone, which is a change too
+		return journal_hash("?",1,h);
+	}
+	struct {
+		dev_t dev;
+		ino_t ino;
+		off_t size;
+		struct timespec mtime;
+	} key;
+	// no stray padding in the hash
+	memset(&key,0,sizeof(key));
+	key.dev = info.st_dev;
+	key.ino = info.st_ino;
+	key.size = info.st_size;
+	key.mtime = info.st_mtim;
+	h = journal_hash(&key,sizeof(key),h);
+	if(contents) h = contents_of(path,&info,h);
+	return h;
+}
+
+uint64_t inputs_fingerprint(const char* inputs, bool contents) {
+	uint64_t h = 0;
+	const char* s = inputs;
+	while(*s) {
+		while(*s == ' ' || *s == '\t' || *s == ',') ++s;
+		if(*s == '\0') break;
+		const char* e = s;
+		while(*e && *e != ' ' && *e != '\t' && *e != ',') ++e;
+		char* pattern = strndup(s,e-s);
+		glob_t found;
+		// sorted, so the same files always hash in the same order
+		int res = glob(pattern,GLOB_NOCHECK|GLOB_BRACE|GLOB_TILDE,NULL,&found);
+		if(res == 0) {
+			size_t i;
+			for(i=0;i<found.gl_pathc;++i) {
+				h = one(found.gl_pathv[i],contents,h);
+			}
+			globfree(&found);
+		} else {
+			h = journal_id(pattern,h);
+		}
+		free(pattern);
+		s = e;
+	}
+	return h;
+}
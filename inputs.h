@@ -0,0 +1,16 @@
+#ifndef INPUTS_H
+#define INPUTS_H
+
+#include <stdbool.h>
+#include <stdint.h>
+
+/* inputs = Makefile *.c lists what a rule's command depends on, as paths or
+	 globs. When none of them changed since the rule last succeeded, it doesn't
+	 run at all. Changed means a different inode, size or mtime, or with
+	 hash_inputs = yes, different contents. Files coming or going count too.
+	 The child checks before running the command, so hashing never holds up the
+	 daemon, and a skipped run still counts as a success for what's after it. */
+
+uint64_t inputs_fingerprint(const char* inputs, bool contents);
+
+#endif /* INPUTS_H */
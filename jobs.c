@@ -0,0 +1,271 @@
+#define _GNU_SOURCE
+#include "jobs.h"
+#include "queue.h" // queue_due
+#include "inputs.h"
+#include "errors.h"
+#include <unistd.h> // fork, sysconf, pipe2
+#include <fcntl.h> // O_CLOEXEC
+#include <sys/time.h> // timersub
+#include <sys/wait.h>
+#include <stdlib.h> // getenv
+#include <string.h> // memset
+
+const char* shell = NULL;
+int logfd = -1;
+
+size_t jobs_max = 1;
+size_t jobs_num = 0;
+
+sigset_t jobs_waitmask;
+static sigset_t original;
+
+struct job* jobs = NULL;
+static size_t space = 0;
+
+static void onchild(int signal) {
+  return;
+}
+
+void jobs_init(void) {
+	const char* s = getenv("jobs");
+	if(s) {
+		jobs_max = strtoul(s,NULL,0);
+	}
+	if(jobs_max == 0) jobs_max = 1;
+	space = jobs_max;
+	jobs = calloc(space,sizeof(*jobs));
+
+	struct sigaction act = {
+		.sa_handler = onchild,
+		.sa_flags = SA_NOCLDSTOP
+	};
+	sigemptyset(&act.sa_mask);
+	sigaction(SIGCHLD,&act,NULL);
+	sigset_t block;
+	sigemptyset(&block);
+	sigaddset(&block,SIGCHLD);
+	sigaddset(&block,SIGHUP);
+	sigprocmask(SIG_BLOCK,&block,&original);
+	jobs_waitmask = original;
+	sigdelset(&jobs_waitmask,SIGCHLD);
+	sigdelset(&jobs_waitmask,SIGHUP);
+	// after a re-exec they're still blocked, but commands shouldn't inherit that
+	sigdelset(&original,SIGCHLD);
+	sigdelset(&original,SIGHUP);
+}
+
+// what the child says about the inputs, before it runs the command
+struct check {
+	uint64_t fingerprint;
+	// when it was done checking, and the CPU that took, so the run doesn't count them
+	struct timespec checked;
+	struct timeval utime;
+	struct timeval stime;
+	bool run;
+};
+
+static pid_t spawn(const struct rule* r, int* check) {
+	// TODO: have a shell process running, and feed it these as lines.
+	if(logfd == STDERR_FILENO) {
+		// so our messages come before the command's output
+		log_flush();
+	}
+	int p[2] = {-1,-1};
+	if(r->inputs && pipe2(p,O_CLOEXEC) != 0) {
+		warn("couldn't check the inputs of %s",rule_name(r));
+	}
+  pid_t pid = fork();
+  if(pid == 0) {
+		sigprocmask(SIG_SETMASK,&original,NULL);
+    /* TODO: put this in... limits.conf file? idk */
+		dup2(logfd,1);
+		dup2(logfd,2);
+		if(r->settings->placement) placement_apply(r->settings->placement);
+		if(p[1] >= 0) {
+			/* hashing can take a while, so it's done here and not in the daemon.
+				 This process execs or exits next, so the inputs aren't freed. */
+			struct check c = {
+				.fingerprint = inputs_fingerprint(rule_inputs(r),r->settings->hash_inputs)
+			};
+			c.run = !(r->fingerprinted && c.fingerprint == r->fingerprint);
+			struct rusage self;
+			getrusage(RUSAGE_SELF,&self);
+			c.utime = self.ru_utime;
+			c.stime = self.ru_stime;
+			getnow(&c.checked);
+			ssize_t amt = write(p[1],&c,sizeof(c));
+			(void)amt;
+			if(!c.run) _exit(0);
+		}
+/*     struct rlimit lim = {
+			 .rlim_cur = 0x100,
+			 .rlim_max = 0x100
+			 };
+			 setrlimit(RLIMIT_NPROC,&lim);
+			 lim.rlim_cur = 200;
+			 lim.rlim_max = 300;
+			 setrlimit(RLIMIT_CPU,&lim); */
+    // no other limits can really be guessed at...
+    execlp(shell,shell,"-c",rule_command(r),NULL);
+		_exit(127);
+  }
+  assert(pid > 0);
+	if(p[1] >= 0) close(p[1]);
+	*check = p[0];
+	return pid;
+}
+
+void job_start(struct rule* r, const struct timespec* now) {
+	assert(jobs_num < jobs_max);
+	struct job* job = jobs + jobs_num;
+	memset(job,0,sizeof(*job));
+	job->rule = r;
+	job->lease = -1;
+	job->check = -1;
+	job->due = r->due;
+	job->started = *now;
+	if(simulating) {
+		// not counting the one about to run
+		job->status = simulate_start(&r->settings->sim,jobs_num,queue_due(now)-1,&job->done);
+		job->pid = -1;
+		memset(&job->usage,0,sizeof(job->usage));
+	} else {
+		job->pid = spawn(r,&job->check);
+	}
+	r->running = true;
+	planner_add(r,now->tv_sec);
+	++jobs_num;
+}
+
+void job_adopt(struct rule* r, pid_t pid, int check,
+							 const struct timespec* due, const struct timespec* started) {
+	if(jobs_num == space) {
+		// the old daemon could run more at once
+		jobs = realloc(jobs,++space*sizeof(*jobs));
+	}
+	struct job* job = jobs + jobs_num++;
+	memset(job,0,sizeof(*job));
+	job->rule = r;
+	job->pid = pid;
+	job->due = *due;
+	job->started = *started;
+	job->lease = -1;
+	job->check = check;
+	if(r) r->running = true;
+}
+
+static void finished(size_t which, void (*done)(struct job* job)) {
+	struct job job = jobs[which];
+	jobs[which] = jobs[--jobs_num];
+	if(job.rule) job.rule->running = false;
+	if(job.check >= 0) {
+		// it's exited, so whatever it wrote is already there
+		struct check c;
+		if(read(job.check,&c,sizeof(c)) == sizeof(c)) {
+			job.skipped = !c.run;
+			job.fingerprinted = true;
+			job.fingerprint = c.fingerprint;
+			// the command started once the check was done
+			job.started = c.checked;
+			timersub(&job.usage.ru_utime,&c.utime,&job.usage.ru_utime);
+			timersub(&job.usage.ru_stime,&c.stime,&job.usage.ru_stime);
+		}
+		close(job.check);
+	}
+	// even if its rule is gone, it still gets reported
+	done(&job);
+	free(job.key);
+	free(job.name);
+	if(job.lease >= 0) close(job.lease);
+}
+
+void jobs_reap(void (*done)(struct job* job)) {
+	size_t i;
+	if(simulating) {
+		struct timespec now;
+		getnow(&now);
+		for(i=0;i<jobs_num;) {
+			if(timespecbefore(&now,&jobs[i].done)) {
+				++i;
+			} else {
+				finished(i,done);
+			}
+		}
+		return;
+	}
+	for(;;) {
+		int status;
+		struct rusage usage;
+		pid_t pid = wait4(-1,&status,WNOHANG,&usage);
+		if(pid <= 0) return;
+		for(i=0;i<jobs_num;++i) {
+			if(jobs[i].pid == pid) {
+				jobs[i].status = status;
+				jobs[i].usage = usage;
+				getnow(&jobs[i].done);
+				finished(i,done);
+				break;
+			}
+		}
+	}
+}
+
+void job_forget(struct rule* r) {
+	size_t i;
+	for(i=0;i<jobs_num;++i) {
+		if(jobs[i].rule == r) {
+			struct job* job = jobs + i;
+			job->rule = NULL;
+			job->set = r->set;
+			job->named = r->name != NULL;
+			job->key = strdup(r->name ? r->name : rule_command(r));
+			job->name = strdup(r->name ? rule_name(r) : rule_command(r));
+			job->lease = r->lease;
+			r->lease = -1;
+			r->running = false;
+			return;
+		}
+	}
+}
+
+void jobs_reattach(struct ruleset* set) {
+	size_t i, j;
+	for(i=0;i<jobs_num;++i) {
+		struct job* job = jobs + i;
+		if(job->rule || job->set != set) continue;
+		// either way, it can't look again
+		job->set = NULL;
+		struct rule* r = NULL;
+		if(job->named) {
+			r = ruleset_find(set,job->key);
+		} else {
+			for(j=0;j<set->num;++j) {
+				if(set->rules[j].name == NULL &&
+					 0 == strcmp(rule_command(set->rules+j),job->key)) {
+					r = set->rules + j;
+					break;
+				}
+			}
+		}
+		if(r == NULL || r->running) continue;
+		// still running, so not due until it finishes
+		job->rule = r;
+		r->running = true;
+		r->lease = job->lease;
+		job->lease = -1;
+		queue_park(r);
+		planner_add(r,job->started.tv_sec);
+	}
+}
+
+bool jobs_next_done(struct timespec* when) {
+	size_t i;
+	bool any = false;
+	for(i=0;i<jobs_num;++i) {
+		if(!any || timespecbefore(&jobs[i].done,when)) {
+			*when = jobs[i].done;
+			any = true;
+		}
+	}
+	return any;
+}
@@ -0,0 +1,68 @@
+#ifndef JOBS_H
+#define JOBS_H
+
+#include "rules.h"
+#include <signal.h>
+#include <sys/resource.h> // struct rusage
+
+/* commands run in the background, up to jobs of them at once (the jobs
+	 environment variable, default 1 so rules still take turns). SIGCHLD (and
+	 SIGHUP, for handover.c) stays blocked except while the main loop waits, so a
+	 child finishing interrupts the wait and nothing else. When simulating, jobs
+	 finish when the virtual clock says so. */
+
+extern const char* shell;
+extern int logfd;
+
+extern size_t jobs_max;
+extern size_t jobs_num;
+
+struct job {
+	// NULL if its rule went away while it ran
+	struct rule* rule;
+	pid_t pid;
+	// when it was due, and when it actually started
+	struct timespec due;
+	struct timespec started;
+	// when it finished (simulations know this in advance)
+	struct timespec done;
+	int status;
+	struct rusage usage;
+	/* while its rules file is being reread: the set, and the name (or command)
+		 to find its rule by afterwards. Then name stays, for reporting it. */
+	struct ruleset* set;
+	char* key;
+	bool named;
+	char* name;
+	// the rule's lease, held until it's done
+	int lease;
+	// a pipe the child sends its inputs fingerprint down, or -1
+	int check;
+	bool fingerprinted;
+	// none of its inputs changed, so the command never ran
+	bool skipped;
+	uint64_t fingerprint;
+};
+
+extern struct job* jobs;
+
+void jobs_init(void);
+// the signal mask to wait with
+extern sigset_t jobs_waitmask;
+
+void job_start(struct rule* r, const struct timespec* now);
+/* a job the daemon started before it re-executed itself, with its check pipe
+	 if it had one. r may be NULL */
+void job_adopt(struct rule* r, pid_t pid, int check,
+							 const struct timespec* due, const struct timespec* started);
+// calls done for each job that has finished
+void jobs_reap(void (*done)(struct job* job));
+/* r is going away, but its set may be about to be reread. Let go of r, and
+	 keep its lease, until jobs_reattach finds it again. */
+void job_forget(struct rule* r);
+// set has been reread, so running rules get their jobs back
+void jobs_reattach(struct ruleset* set);
+// when the next simulated job finishes, false if none are running
+bool jobs_next_done(struct timespec* when);
+
+#endif /* JOBS_H */
@@ -0,0 +1,77 @@
+#define _GNU_SOURCE
+#include "journal.h"
+#include "errors.h"
+#include <fcntl.h> // openat
+#include <sys/stat.h> // mkdir
+#include <unistd.h> // write
+#include <stdio.h> // snprintf, dprintf
+#include <time.h>
+
+static int history = -1;
+static int names = -1;
+static int segment = -1;
+static time_t segment_day = -1;
+
+void journal_init(void) {
+	mkdir("history",0755);
+	history = open("history",O_RDONLY|O_DIRECTORY|O_CLOEXEC);
+	if(history < 0) {
+		warn("not keeping a history of runs");
+		return;
+	}
+	names = openat(history,"names",O_WRONLY|O_APPEND|O_CREAT|O_CLOEXEC,0644);
+}
+
+static int64_t nanos(const struct timespec* t) {
+	return t->tv_sec * INT64_C(1000000000) + t->tv_nsec;
+}
+
+static int64_t micros(const struct timeval* t) {
+	return t->tv_sec * INT64_C(1000000) + t->tv_usec;
+}
+
+static bool open_segment(time_t when) {
+	time_t day = when / SECS_PER_DAY;
+	if(day == segment_day && segment >= 0) return true;
+	if(segment >= 0) close(segment);
+	struct tm date;
+	time_t start = day * SECS_PER_DAY;
+	gmtime_r(&start,&date);
+	char name[0x20];
+	strftime(name,sizeof(name),"%Y-%m-%d.runs",&date);
+	segment = openat(history,name,O_WRONLY|O_APPEND|O_CREAT|O_CLOEXEC,0644);
+	segment_day = day;
+	return segment >= 0;
+}
+
+void journal_record(const struct job* job) {
+	if(history < 0) return;
+	struct rule* r = job->rule;
+	const char* name = job->name;
+	if(r) name = r->name ? rule_name(r) : rule_command(r);
+	// adopted after a re-exec, with its rule already gone
+	if(name == NULL) return;
+	struct run_record record = {
+		.rule = journal_id(name,0),
+		.due = nanos(&job->due),
+		.start = nanos(&job->started),
+		.end = nanos(&job->done),
+		.utime = micros(&job->usage.ru_utime),
+		.stime = micros(&job->usage.ru_stime),
+		.maxrss = job->usage.ru_maxrss,
+		.status = job->status
+	};
+	if((r == NULL || !r->journaled) && names >= 0) {
+		// once per rule per daemon is plenty, duplicates don't hurt
+		dprintf(names,"%016llx %s\n",(unsigned long long)record.rule,name);
+		if(r) r->journaled = true;
+	}
+	if(!open_segment(job->done.tv_sec)) {
+		warn("couldn't open the history for %s",name);
+		return;
+	}
+	// appends this small are atomic, so no torn records
+	if(sizeof(record) != write(segment,&record,sizeof(record))) {
+		warn("couldn't record the run of %s",name);
+	}
+}
@@ -0,0 +1,56 @@
+#ifndef JOURNAL_H
+#define JOURNAL_H
+
+#include <stdint.h>
+#include <stdbool.h>
+#include <string.h> // strlen
+
+/* every finished run gets appended to history/<day>.runs (UTC) as one fixed
+	 size record, so regularly-history can mmap a week of them and answer
+	 questions without parsing any text. history/names maps rule ids back to
+	 names. */
+
+struct run_record {
+	// journal_id of the rule's namespace/name
+	uint64_t rule;
+	// nanoseconds since the epoch
+	int64_t due;
+	int64_t start;
+	int64_t end;
+	// microseconds of CPU
+	int64_t utime;
+	int64_t stime;
+	// kilobytes
+	int64_t maxrss;
+	// as from wait4
+	int32_t status;
+	uint32_t reserved;
+};
+
+_Static_assert(sizeof(struct run_record) == 64, "records are fixed size");
+
+#define SECS_PER_DAY 86400
+
+static inline uint64_t journal_hash(const void* p, size_t len, uint64_t h) {
+	// FNV-1a
+	const unsigned char* c = p;
+	if(h == 0) h = UINT64_C(0xcbf29ce484222325);
+	for(;len;--len,++c) {
+		h ^= *c;
+		h *= UINT64_C(0x100000001b3);
+	}
+	return h;
+}
+
+static inline uint64_t journal_id(const char* s, uint64_t h) {
+	return journal_hash(s,strlen(s),h);
+}
+
+#ifndef JOURNAL_TOOL
+#include "jobs.h"
+
+void journal_init(void);
+void journal_record(const struct job* job);
+#endif
+
+#endif /* JOURNAL_H */
@@ -0,0 +1,235 @@
+#define _GNU_SOURCE
+#include "lease.h"
+#include "errors.h"
+#include "journal.h" // journal_id
+#include <fcntl.h> // F_OFD_SETLK
+#include <sys/stat.h> // mkdirat, fstat
+#include <dirent.h>
+#include <unistd.h> // gethostname
+#include <string.h>
+#include <stdio.h> // snprintf
+#include <stdint.h>
+#include <stddef.h> // offsetof
+
+bool leasing = false;
+
+static int leases = -1;
+static int members = -1;
+static char me[0x100];
+static int mine = -1;
+
+static char** alive = NULL;
+static size_t nalive = 0;
+static struct timespec checked = {};
+
+// how often to look for instances that came or went
+#define RECHECK 10
+
+// what's in leases/<rule>
+struct record {
+	struct timespec last;
+	struct timespec due;
+};
+
+static uint64_t mix(uint64_t h) {
+	// splitmix64 finalizer, so similar names don't get similar scores
+	h ^= h >> 30;
+	h *= UINT64_C(0xbf58476d1ce4e5b9);
+	h ^= h >> 27;
+	h *= UINT64_C(0x94d049bb133111eb);
+	h ^= h >> 31;
+	return h;
+}
+
+static bool lock(int fd, short type) {
+	struct flock l = {
+		.l_type = type,
+		.l_whence = SEEK_SET
+	};
+	return 0 == fcntl(fd,F_OFD_SETLK,&l);
+}
+
+static void join(void) {
+	if(mine >= 0) close(mine);
+	mine = openat(members,me,O_RDWR|O_CREAT|O_CLOEXEC,0644);
+	assert(mine >= 0);
+	if(!lock(mine,F_WRLCK)) {
+		error("another instance is already called %s",me);
+	}
+}
+
+static void check_members(void) {
+	struct stat info;
+	if(0 == fstat(mine,&info) && info.st_nlink == 0) {
+		// someone thought we were dead before we had our lock
+		join();
+	}
+	size_t i;
+	for(i=0;i<nalive;++i) free(alive[i]);
+	nalive = 0;
+
+	int fd = dup(members);
+	DIR* d = fdopendir(fd);
+	assert(d);
+	rewinddir(d);
+	struct dirent* ent;
+	while((ent = readdir(d))) {
+		if(ent->d_name[0] == '.') continue;
+		if(0 != strcmp(ent->d_name,me)) {
+			int other = openat(members,ent->d_name,O_RDONLY|O_CLOEXEC);
+			if(other < 0) continue;
+			struct flock l = {
+				.l_type = F_WRLCK,
+				.l_whence = SEEK_SET
+			};
+			int res = fcntl(other,F_OFD_GETLK,&l);
+			close(other);
+			if(res == 0 && l.l_type == F_UNLCK) {
+				// nobody holds it, so that instance is gone
+				info("instance %s is dead",ent->d_name);
+				unlinkat(members,ent->d_name,0);
+				continue;
+			}
+		}
+		if(nalive%0x10 == 0) {
+			alive = realloc(alive,(nalive+0x10)*sizeof(*alive));
+		}
+		alive[nalive++] = strdup(ent->d_name);
+	}
+	closedir(d);
+}
+
+void lease_init(int member) {
+	const char* dir = getenv("leases");
+	if(dir == NULL || simulating) return;
+	mkdir(dir,0755);
+	leases = open(dir,O_RDONLY|O_DIRECTORY|O_CLOEXEC);
+	assert(leases >= 0);
+	mkdirat(leases,"members",0755);
+	members = openat(leases,"members",O_RDONLY|O_DIRECTORY|O_CLOEXEC);
+	assert(members >= 0);
+
+	const char* name = getenv("instance");
+	if(name) {
+		snprintf(me,sizeof(me),"%s",name);
+	} else {
+		char host[0x80];
+		gethostname(host,sizeof(host));
+		host[sizeof(host)-1] = '\0';
+		snprintf(me,sizeof(me),"%s.%d",host,getpid());
+	}
+	if(member >= 0) {
+		// still locked, from before we re-executed ourselves
+		mine = member;
+		fcntl(mine,F_SETFD,FD_CLOEXEC);
+	} else {
+		join();
+	}
+	leasing = true;
+}
+
+int lease_member(void) {
+	return mine;
+}
+
+static const char* lease_name(struct rule* r) {
+	static char buf[0x200];
+	const char* name = r->name ? rule_name(r) : rule_command(r);
+	snprintf(buf,sizeof(buf),"%s",name);
+	char* c;
+	for(c=buf;*c;++c) {
+		if(*c == '/') *c = '%';
+	}
+	return buf;
+}
+
+static bool load(int fd, struct record* record) {
+	return sizeof(*record) == pread(fd,record,sizeof(*record),0);
+}
+
+// someone else has it, so check back when it's due, or soon if it already is
+static void later(struct rule* r, const struct timespec* now, const struct record* record) {
+	r->due = *now;
+	r->due.tv_sec += RECHECK;
+	if(record && timespecbefore(&r->due,&record->due)) r->due = record->due;
+}
+
+// rendezvous hashing: whoever scores highest for this rule owns it
+static bool owned(const char* name) {
+	// mixed first, so rules with similar names don't all land in one place
+	uint64_t key = mix(journal_id(name,0));
+	const char* owner = NULL;
+	uint64_t best = 0;
+	size_t i;
+	for(i=0;i<nalive;++i) {
+		uint64_t score = mix(key ^ journal_id(alive[i],0));
+		if(owner == NULL || score > best) {
+			best = score;
+			owner = alive[i];
+		}
+	}
+	return owner && 0 == strcmp(owner,me);
+}
+
+bool lease_claim(struct rule* r) {
+	if(!leasing) return true;
+	struct timespec now;
+	getnow(&now);
+	if(now.tv_sec - checked.tv_sec >= RECHECK) {
+		check_members();
+		checked = now;
+	}
+	const char* name = lease_name(r);
+	struct record record;
+	/* only the instance that ran what a triggered rule is after knows to run
+		 it, so that one does, whoever owns it. The lock still keeps it to one. */
+	if(!r->triggered && !owned(name)) {
+		int fd = openat(leases,name,O_RDONLY|O_CLOEXEC);
+		bool have = fd >= 0 && load(fd,&record);
+		if(fd >= 0) close(fd);
+		later(r,&now,have ? &record : NULL);
+		return false;
+	}
+	r->lease = openat(leases,name,O_RDWR|O_CREAT|O_CLOEXEC,0644);
+	if(r->lease < 0) {
+		warn("couldn't open the lease for %s",rule_name(r));
+		later(r,&now,NULL);
+		return false;
+	}
+	if(!lock(r->lease,F_WRLCK)) {
+		info("%s is leased by someone else",rule_name(r));
+		close(r->lease);
+		r->lease = -1;
+		later(r,&now,NULL);
+		return false;
+	}
+	if(load(r->lease,&record) && !timespecbefore(&record.last,&r->due) &&
+		 timespecbefore(&now,&record.due)) {
+		// whoever had it before us already ran it, since it came due here
+		info("%s already ran at %ld",rule_name(r),record.last.tv_sec);
+		close(r->lease);
+		r->lease = -1;
+		r->due = record.due;
+		return false;
+	}
+	record.last = now;
+	record.due = r->due;
+	if(sizeof(record) != pwrite(r->lease,&record,sizeof(record),0)) {
+		warn("couldn't record the run of %s in its lease",rule_name(r));
+	}
+	return true;
+}
+
+void lease_release(struct rule* r) {
+	if(r->lease < 0) return;
+	// waiting on something only we know about isn't a due time to share
+	if(!r->triggered && r->due.tv_sec != NEVER) {
+		if(sizeof(r->due) != pwrite(r->lease,&r->due,sizeof(r->due),
+																offsetof(struct record,due))) {
+			warn("couldn't record when %s is due in its lease",rule_name(r));
+		}
+	}
+	// closing the only descriptor drops the OFD lock
+	close(r->lease);
+	r->lease = -1;
+}
@@ -0,0 +1,35 @@
+#ifndef LEASE_H
+#define LEASE_H
+
+#include "rules.h"
+
+/* sharing one rules file between several daemons, maybe on different machines.
+	 Set leases to a directory they all can see (and lock in), and instance to a
+	 name unique to each daemon (default hostname.pid).
+
+	 Every live instance holds a lock on leases/members/<instance>, so when one
+	 dies its lock goes away with it. Rules are assigned to the live instances by
+	 rendezvous hashing, so only the dead instance's rules move. Before running a
+	 rule, its owner also locks leases/<rule>, so two instances that briefly
+	 disagree about who is alive still won't run it twice. Rules that are after
+	 another one are the exception: whoever ran that one runs them, since it's
+	 the only instance that knows they were triggered.
+
+	 leases/<rule> also says when the rule last started and when it's due next,
+	 so whoever owns it next carries on from there instead of from its own idea
+	 of the schedule. The others look at it every RECHECK seconds once it's due,
+	 in case its owner died.
+*/
+
+extern bool leasing;
+
+// member is the lock on our membership if we inherited one, otherwise -1
+void lease_init(int member);
+int lease_member(void);
+/* should we run this rule? If so, hold its lease until lease_release.
+	 If not, r->due is when to ask again. */
+bool lease_claim(struct rule* r);
+// r->due is when it's next due, for whoever owns it then
+void lease_release(struct rule* r);
+
+#endif /* LEASE_H */
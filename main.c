@@ -1,534 +1,206 @@
 #define _GNU_SOURCE
 #include "errors.h"
-#include "parse.h" // next_token
+#include "parse.h" // parse_interval
+#include "simulate.h"
+#include "queue.h"
+#include "sources.h"
+#include "lease.h"
+#include "uring.h"
+#include "jobs.h"
+#include "journal.h"
+#include "control.h"
+#include "handover.h"
 #include <time.h>
-#include <string.h> // memcpy, memmove
+#include <string.h> // strcmp, strsignal
 #include <fcntl.h> // open, O_RDONLY
 #include <sys/stat.h>
-#include <sys/mman.h>
 #include <pwd.h>
 #include <unistd.h> // getuid
 #include <sys/inotify.h>
 #include <sys/time.h> // setrlimit
 #include <sys/resource.h> // setrlimit
 #include <sys/wait.h> // waitpid
-#include <ctype.h> // isspace
-#include <libgen.h> // dirname
 #include <poll.h>
 #include <errno.h>
 #include <stdio.h>
 
-// sigh
-#define WRITE(s,n) fwrite(s,n,1,stderr)
-#define WRITELIT(l) WRITE(l,sizeof(l)-1)
-#define NL() fputc('\n',stderr);
-
-void parse_interval(struct tm* dest,
-										const char* s,
-										ssize_t len) {
-  struct parser ctx = {
-		.s = s,
-		.len = len,
-  };
-
-	// intervals are NOT valid times, gmtime_r(0,&this) makes a different result
-	memset(dest,0,sizeof(struct tm));
-  while(next_token(&ctx)) {
-		if(ctx.state == SEEKNUM) {
-			memcpy(dest,&ctx.interval,sizeof(*dest));
-		}
-  }
-}
-
-struct rule {
-  struct tm interval;
-	struct tm failing;
-  uint8_t retries;
-	uint8_t retried;
-  struct timespec due;
-  char* command;
-  ssize_t command_length;
-  bool disabled;
-	char* name;
-};
-
-/* sorting strategy:
-	 first, sort according to soonest due (0 elements)
-	 when we insert, search for insertion point, then (maybe) realloc, shift up, and insert.
-	 
-	 Then, soonest will always be element #1 since until due is updated, all
-	 countdown by same time.
-*/
-
-/* if a,b,c are before but not d, e, f, insert before d
-	 if re-inserting d, a,b,c are before, but not d, but d is the current one,
-	 so check e,f,etc. not e, so insert before e (i.e. do nothing)
-*/
-static size_t find_point(struct rule* r, size_t num, struct timespec due) {
-	struct timespec now;
-	clock_gettime(CLOCK_REALTIME,&now);
-	info("find point %d %d",num,due.tv_sec-now.tv_sec);
-	if(num == 0) return 0;
-	if(num < 4) {
-		int i;
-		// binary search doesn't work, or isn't cheaper than linear search
-		for(i=0;i<num;++i) {
-			if(timespecbefore(&due,&r[i].due)) return i;
-		}
-		// add it onto the end?
-		return num;
-	}
-
-	size_t lo, hi;
-	lo = 0;
-	hi = num-1;
-
-	for(;;) {
-		if(lo+1 == hi) {
-			// then (lo+hi)>>1 == lo
-			// now before lo, after hi, or in between (lo+0,lo+2,lo+1)?
-			if(timespecbefore(&due, &r[lo].due)) {
-				info("before lo %d",lo);
-				return lo;
-			} else if(timespecbefore(&due, &r[hi].due)) {
-				info("in between %d %d",lo,hi);
-				return lo+1;
-			} else {
-				info("after hi %d",hi+1);
-				return hi+1;
-			}
-		}
-
-		size_t i = (lo+hi)>>1;
-		if(timespecbefore(&due, &r[i].due)) {
-			info("set hi %d→%d %d",hi,i,lo);
-			hi = i;
-		} else if(timespecequal(&due, &r[i].due)) {
-			lo = i;
-			info("point = %d",i);
-			return i;
-		} else {
-			info("set lo %d→%d %d",lo,i,hi);
-			lo = i;
-		}
-	}
-}
-static size_t sort_insert(struct rule* r, size_t num, struct timespec due) {
-	size_t i = find_point(r,num,due);
-	// found insertion point. now shift old ones up
-
-	if(i < num) {
-		// assume we've pre-allocated enough space to shift up
-		memmove(r+i+1,r+i,sizeof(*r) * (num-i));
-	}
-
-	// now r[i] is duplicate of r[i+1] so scrap r[i]
-	r[i].due = due;
-	return i; // still needs initialization!
-}
-
-static void show_rules(struct rule* r, size_t num) {
+#ifndef SILENT_INFO
+static void show_rules(void) {
+	if(log_level > LOG_INFO) return;
 	struct timespec now;
-	clock_gettime(CLOCK_REALTIME,&now);
-	int i;
-	puts("Rules:");
-	for(i=0;i<num;++i) {
+	getnow(&now);
+	size_t i;
+	info("Rules:");
+	for(i=0;i<queue_num;++i) {
 		struct timespec left;
-		timespecsub(&left, &r[i].due, &now);
-		printf("  %d: %s (%s) %d\n",
-					 i,
-					 r[i].name,
-					 interval_tostr(&r[i].interval),
-					 left.tv_sec);
+		timespecsub(&left, &queue[i]->due, &now);
+		info("  %zu: %s (%s) %ld",
+				 i,
+				 rule_name(queue[i]),
+				 interval_tostr(&queue[i]->interval),
+				 left.tv_sec);
 	}
-	puts("-----");
+	info("-----");
 }
+#endif
 
-static size_t sort_adjust(struct rule* r, size_t num, size_t which) {
-	// "due" changed on r+which so find its new spot, and shift accordingly
-	int i = find_point(r,num,r[which].due);
-	if(i == which) return i;
-	struct rule T = r[which];
-	if(i < which) {
-		/* 0 1 2 i 4 5 6 which 7 8
-			 save which into T
-			 shift i 4 5 6 up into which
-			 restore T into i
-		*/
-		memmove(r+i+1,r+i,sizeof(*r) * (which-i));
-		++i;
-	} else {
-		/* 0 1 2 which 4 5 6 i 7 8
-			 save which into T
-			 shift 4 5 6 i down into which
-			 restore T into i
-		*/
-		memmove(r+which,r+which+1,sizeof(*r) * (i-which));
-		--i;
+void update_due_adjust(struct rule* r, const struct timespec* base) {
+	if(r->triggered || r->disabled) {
+		// waits for what it's after, or to be resumed
+		queue_park(r);
+		return;
 	}
+	/* TODO: specify the base from which intervals are calculated */
+	rule_next_due(r, base, true);
+	rule_save_due(r);
+	queue_adjust(r);
 #ifndef SILENT_INFO
-	show_rules(r,num);
-	info("going in %d",i);
-#endif
-	r[i] = T;
-#ifndef SILENT_INFO
-	show_rules(r,num);
+	show_rules();
 #endif
-	return i;
-}
-
-struct rule default_rule = {
-	.interval = { .tm_hour = 1 },
-	.failing = { .tm_hour = 2 },
-	.retries = 0
-};
-
-static void later_time(struct timespec* dest,
-											 const struct tm* interval,
-											 const struct timespec* base) {
-	struct tm date;
-  gmtime_r(&base->tv_sec,&date);
-  advance_interval(&date,interval);
-	dest->tv_sec = mymktime(date) + 1;
-	dest->tv_nsec = 0;
-	// have it happen at the BEGINNING of the second, or the END of the second?
-	// or at base->tv_nsec nanoseconds after the second?
-	// end is prettier
 }
 
-void update_due_adjust(struct rule* r, size_t num, ssize_t which,
-											 const struct timespec* base) {
-	/* TODO: specify the base from which intervals are calculated */
-	later_time(&r[which].due, &r[which].interval, base);
-	if(r->name) {
-		chdir("dues");
-		char temp[] = ".tempXXXXXX";
-		int out = mkstemp(temp);
-		if(out >= 0) {
-			size_t amt = write(out,&r[which].due,sizeof(r[which].due));
-			int closed = close(out);
-			assert(closed == 0);
-			assert(amt == sizeof(r[which].due));
-			if(closed == 0 && amt == sizeof(r[which].due)) {
-				int res = rename(temp,r->name);
-				assert(0==res);
-			} else {
-				unlink(temp);
-			}
+static bool succeeded(const char* name, int status) {
+	if(WIFSIGNALED(status)) {
+		warn("%s died with %d (%s)",name,
+				 WTERMSIG(status),strsignal(WTERMSIG(status)));
+	} else if(WIFEXITED(status)) {
+		if (0 == WEXITSTATUS(status)) {
+			return true;
+		} else {
+			warn("%s exited with %d",name,WEXITSTATUS(status));
 		}
-		chdir("..");
+	} else {
+		error("command neither exited or died? WTF??? %d",status);
 	}
-	sort_adjust(r,num,which);
+	return false;
 }
 
-const char* rules_override = NULL;
-
-struct rule* parse(struct rule* ret, size_t* space) {
-  int fd;
-	if(rules_override==NULL) {
-		fd = open("rules", O_RDONLY);
+static void finished(struct job* job) {
+	struct rule* r = job->rule;
+	int status = job->status;
+	struct timespec now;
+	getnow(&now);
+	// its child found nothing changed, which is as good as running it
+	bool success = true;
+	if(job->skipped) {
+		if(r == NULL) return;
+		info("nothing %s uses has changed",rule_name(r));
 	} else {
-		fd = open(rules_override, O_RDONLY);
-	}
-  if(fd < 0) return NULL;
-  struct stat file_info;
-  fstat(fd,&file_info);
-  const char* s = mmap(NULL, file_info.st_size,PROT_READ,MAP_PRIVATE,fd,0);
-  assert(s);
-  int num = 0;
-  struct timespec now;
-  clock_gettime(CLOCK_REALTIME,&now);
-  size_t i = 0;
-  while(i<file_info.st_size) {
-		// parse name=value pairs, committing with a command.
-		size_t start = i;
-		size_t eq = start;
-		bool goteq = false;
-		for(;;) {
-			if(s[i] == '\n') break;
-			if(s[i] == '=') {
-				eq = i;
-				goteq = true;
-			}
-			if(++i == file_info.st_size) {
-				//info("doesn't end in a newline");
-				break;
-			}
+		journal_record(job);
+		if(r == NULL) {
+			// its rule is gone from the rules file, so there's only the log to tell
+			const char* name = job->name ? job->name : "(gone)";
+			if(succeeded(name,status)) warn("%s finished, but it's no longer a rule",name);
+			return;
 		}
-		size_t sname = start;
-		size_t ename = eq;
-		size_t sval = eq+1;
-		size_t eval = i;
-	
-		bool is_a_command(void) {
-			if(sval >= eval) {
-				// newline
-				//info("newline");
-				return false;
-			}
-			//info("nanewline %d %d",sval,eval);
-			if(!goteq) {
-				--sval; // eq is start, so eq+1 is BAD
-				return true; // it's a command
-			}
-			for(;;) {
-				// strip trailing spaces from name
-				if(ename == start) {
-					// empty name means command
-					return true;
-				}
-				if(isspace(s[ename-1])) {
-					--ename;
-				} else {
-					break;
-				}
-			}
-			for(;;) {
-				// strip leading spaces from name
-				if(sname == ename) {
-					// empty name means command
-					return true;
-				}
-				if(isspace(s[sname])) {
-					++sname;
-				} else {
-					break;
-				}
-			}
-		
-			for(;;) {
-				// strip trailing spaces from value
-				if(eval == sval) {
-					WRITELIT("warning: empty value for ");
-					WRITE(s+sname,ename-sname);
-					NL();
-					return false; // still not a command
-				}
-				if(isspace(s[eval-1])) {
-					--eval;
-				} else {
-					break;
-				}
-			}
-		
-			for(;;) {
-				// strip leading spaces from value
-				if(sval == eval) {
-					WRITELIT("warning: empty value for ");
-					WRITE(s+sname,ename-sname);
-					NL();
-					return false; // still not a command
-				}
-				if(isspace(s[sval])) {
-					++sval;
-				} else {
-					break;
-				}
-			}
-
-			// not a command, but needs handling
+		planner_learn(r,job);
+		success = succeeded(rule_name(r),status);
+	}
 
-#define NAME_IS(N) (ename-sname == sizeof(N)-1 && 0==memcmp(s+sname,N,sizeof(N)-1))
-			if(NAME_IS("name")) {
-				default_rule.name = realloc(default_rule.name,eval-sval+1);
-				memcpy(default_rule.name,s+sval,eval-sval);
-				default_rule.name[eval-sval] = '\0';
-				info("found name %s",default_rule.name);
-				return false;
-			} else if(NAME_IS("wait") || NAME_IS("interval")) {
-				parse_interval(&default_rule.interval,s+sval,eval-sval);
-				return false;
-			} else if(NAME_IS("retries")) {
-				// we know the end already is eval.
-				char* enumber = NULL;
-				// base == 0 allows for 0xFF and 0755 syntax
-				size_t retries = strtol(s+sval,&enumber,0);
-				if(enumber == s + eval) {
-					default_rule.retries = retries;
-				} else {
-					WRITELIT("warning: ignoring retries because not a number: ");
-					WRITE(s+sval,eval-sval);
-					NL();
-				}
-				return false;
-			} else if(NAME_IS("failing")) {
-				parse_interval(&default_rule.failing,s+sval,eval-sval);
-				return false;
-			}
-			// assume the command contains an '=' sign and this line isn't a n=v pair
-			return true;
+	// whatever's after this one can start right away
+	size_t i;
+	for(i=0;i<r->ndependents;++i) {
+		if(success || !r->dependents[i].success) {
+			queue_trigger(r->dependents[i].rule,&now);
 		}
+	}
 
-		if(is_a_command()) {
-			// use sval and eval because might be command= or just a leading =
-			
-			{
-				
-				time_t a = interval_secs_from(&now, &default_rule.interval);
-				time_t b = interval_secs_from(&now, &default_rule.failing);
-				// sanity check
-				if(b < a) {
-					char normal[0x100];
-					char failing[0x100];
-					interval_tostr_r(&default_rule.failing, failing, 0x100);
-					interval_tostr_r(&default_rule.interval, normal, 0x100);
-					warn("failing set to lower than normal wait time... %d '%s' < %d '%s' adjusting.",
-							 b,
-							 failing,
-							 a,
-							 normal);
-					interval_mul(&default_rule.failing, &default_rule.interval, 2);
-				}
-			}
-
-			default_rule.command = malloc(eval-sval+1);
-			memcpy(default_rule.command,s+sval,eval-sval);
-			default_rule.command[eval-sval] = '\0';
-			// we're not gonna mess with shell parsing... just pass to the shell.
-			
-
-			if(num%(1<<8)==0) {
-				/* faster to allocate in chunks */
-				size_t old = *space;
-				*space += ((num>>8)+1)<<8;
-				ret = realloc(ret,*space*sizeof(struct rule));
-			}
-			
-			size_t which;
-			if(getenv("nowait")) {
-				which = num; // all have same sorting key
-				// just make everything due on startup
-				memcpy(&default_rule.due,&now,sizeof(now));
-			} else {
-				void setdue() {
-					if(default_rule.name) {
-						// maybe deserialize
-						chdir("dues");
-						int in = open(default_rule.name,O_RDONLY);
-						chdir("..");
-						if(in >= 0) {
-							if(
-								sizeof(default_rule.due) ==
-								read(in, &default_rule.due, sizeof(default_rule.due)))
-								return;
-						}
-					}
-					later_time(&default_rule.due,&default_rule.interval,&now);
-					// eh, copies due twice
-				}
-				setdue();
-				which = sort_insert(ret,num,default_rule.due);
-			}
-			memcpy(ret+which,&default_rule,sizeof(struct rule));
-
-			// any n=v pairs now committed to the current rule.
-			// further rules will use the same values unless specified
+	if(success && job->fingerprinted && !job->skipped) {
+		rule_save_fingerprint(r,job->fingerprint);
+	}
 
-			//info("%d name should have copied %s == %s",which, default_rule.name, ret[which].name);
-			// be sure to transfer ownership of the name pointer. (move semantics)
-			default_rule.name = NULL;
-			default_rule.command = NULL;
-			++num;
-#ifndef SILENT_INFO
-			show_rules(ret,num);
-#endif
+	if(!success && scheduled(&r->settings->schedule)) {
+		// the calendar says when it runs, not how the last run went
+		warn("%s runs again at its next scheduled time",rule_name(r));
+	} else if(!success) {
+		if(r->retried == 0) {
+			interval_between(&r->interval,&r->interval,&r->settings->failing);
+			warn("slowing down to %ld %s",
+					 interval_secs_from(&now,&r->interval),
+					 interval_tostr(&r->interval));
+			r->retried = r->settings->retries;
+		} else {
+			--r->retried;
 		}
-		++i;
-  }
-DONE:
-  munmap((void*)s,file_info.st_size);
-  // now we don't need the trailing chunk
-  *space = num;
-  ret = realloc(ret,num*sizeof(struct rule));
-  return ret;
-}
-
-void onchild(int signal) {
-  return;
-}
-
-const char* shell = NULL;
-
-int logfd = -1;
-
-int mysystem(const char* command) {
-	// TODO: have a shell process running, and feed it these as lines.
-  int pid = fork();
-  if(pid == 0) {
-    /* TODO: put this in... limits.conf file? idk */
-		dup2(logfd,1);
-		dup2(logfd,2);
-/*     struct rlimit lim = {
-			 .rlim_cur = 0x100,
-			 .rlim_max = 0x100
-			 };
-			 setrlimit(RLIMIT_NPROC,&lim);
-			 lim.rlim_cur = 200;
-			 lim.rlim_max = 300;
-			 setrlimit(RLIMIT_CPU,&lim); */
-    // no other limits can really be guessed at...
-    execlp(shell,shell,"-c",command,NULL);
-  }
-  assert(pid > 0);
-  int status = 0;
-  assert(pid == waitpid(pid,&status,0));
-  return status;
+	}
+	// okay, it's done, update due for the next run
+	update_due_adjust(r,&now);
+	// and tell whoever runs it next
+	lease_release(r);
+	if(r->retrigger) {
+		r->retrigger = false;
+		queue_trigger(r,&now);
+	}
 }
 
 int main(int argc, char *argv[])
 {
 
+	log_init();
 	calendar_init();
+
+	if(argc == 3 && 0==strcmp(argv[1],"--simulate")) {
+		struct tm duration;
+		parse_interval(&duration,argv[2],strlen(argv[2]));
+		simulate_init(&duration);
+	} else if(argc != 1) {
+		error("usage: %s [--simulate <duration>]",argv[0]);
+	}
+	handover_init(argv);
 	
   struct passwd* me = NULL;
   int ino = -1;
-  struct rule* r = NULL;
-  size_t space = 0;
+	struct rule* r = NULL;
   struct timespec now,left;
 
 	void setleft() {
-		timespecsub(&left, &r[0].due, &now);
+		struct timespec next = { .tv_sec = NEVER };
+		// can't start anything new until something finishes
+		if(queue_num && jobs_num < jobs_max) next = queue[0]->due;
+		if(simulating) {
+			struct timespec done;
+			if(jobs_next_done(&done) && timespecbefore(&done,&next)) next = done;
+		}
+		timespecsub(&left, &next, &now);
 		if(left.tv_sec <= 0) {
 			// no time travel, please
 			// less than a second is ok because several may come due at once.
 			left.tv_sec = 1;
 			left.tv_nsec = 0;
+		} else if(left.tv_sec > 86400) {
+			// nothing's coming up, but don't ask ppoll to wait forever
+			left.tv_sec = 86400;
 		}
-		warn("delay is %s? waiting %d",
-				 interval_tostr(&r[0].interval),
-				 left.tv_sec);
+		info("waiting %ld",left.tv_sec);
 	}
 
 	
-  struct pollfd things[1] = { {
+	// inotify, then the control socket's two
+  struct pollfd things[3] = { {
 			.fd = -1,
 			.events = POLLIN
 		} };
   ssize_t amt;
 
-  ino = inotify_init();
+  ino = inotify_init1(IN_CLOEXEC);
 
-	rules_override = getenv("rules");
+	const char* paths = getenv("rules");
   
-	if(NULL==rules_override) {
+	if(NULL==paths) {
 		me = getpwuid(getuid());
 		assert_zero(chdir(me->pw_dir));
 		assert_zero(chdir(".config"));
 		mkdir("regularly",0755);
 		assert_zero(chdir("regularly"));
 		mkdir("logs",0755);
+		control_init("control");
 		// to avoid springing inotify every time a child PID closes its logfd
-		logfd = open("logs/current",O_APPEND|O_WRONLY|O_CREAT,0644);
-		inotify_add_watch(ino,".",IN_MOVED_TO|IN_CLOSE_WRITE);
+		logfd = open("logs/current",O_APPEND|O_WRONLY|O_CREAT|O_CLOEXEC,0644);
 	} else {
 		logfd = STDERR_FILENO;
-		char* csux = strdup(rules_override);
-		inotify_add_watch(ino,dirname(csux),IN_MOVED_TO|IN_CLOSE_WRITE);
-		free(csux);
+		control_init(NULL);
 	}
 
-	mkdir("dues",0755);
-
   things[0].fd = ino;
 
   /*shell = me->pw_shell;
@@ -541,12 +213,23 @@ int main(int argc, char *argv[])
   // better to have a standard behavior not based on your login shell.
   shell = "sh";
 
-REPARSE:
-  r = parse(r,&space);
-	unsetenv("nowait");
+	jobs_init();
+	lease_init(handover_member());
+	if(!simulating) {
+		uring_init();
+		journal_init();
+	}
+
+	nowait = NULL != getenv("nowait");
+	sources_init(ino,paths);
+	nowait = false;
+	if(handover_restore()) {
+		// some may have finished while we were re-executing
+		goto REAP;
+	}
   
 MAYBE_RUN_RULE:
-  if(r) {
+  if(queue_num) {
 		goto RUN_RULE;
   } else {
 		warn("Couldn't find any rules!");
@@ -554,12 +237,27 @@ MAYBE_RUN_RULE:
 		left.tv_nsec = 0;
   }
 WAIT_FOR_CONFIG:
-	if(r) {
+	// idle now, so write out anything we logged
+	if(!uring) log_flush();
+	if(simulating) {
+		if(queue_num == 0) error("nothing to simulate");
+		setleft();
+		simulate_sleep(&left);
+		goto REAP;
+	}
+	control_fds(things+1);
+	if(queue_num) {
 		setleft();
 		if(left.tv_sec == 0 && left.tv_nsec == 0) goto MAYBE_RUN_RULE;
-		amt = ppoll(things,1,&left,NULL);
+		if(uring) {
+			amt = uring_poll(things,3,&left,&jobs_waitmask);
+		} else {
+			amt = ppoll(things,3,&left,&jobs_waitmask);
+		}
+	} else if(uring) {
+		amt = uring_poll(things,3,NULL,&jobs_waitmask);
 	} else {
-		amt = ppoll(things,1,NULL,NULL);
+		amt = ppoll(things,3,NULL,&jobs_waitmask);
 	}
   if(amt == 0) {
 		// no things (no config updates) so we're golden.
@@ -567,72 +265,71 @@ WAIT_FOR_CONFIG:
   }
   if(amt < 0) {
 		assert(errno == EINTR);
-		goto WAIT_FOR_CONFIG;
+		// probably SIGCHLD
+		goto REAP;
   }
+	control_ready(things+1);
   if(things[0].revents & POLLIN) {
 		static char buf[0x1000]
 			__attribute__ ((aligned(__alignof__(struct inotify_event))));
 		ssize_t len = read(ino,buf, sizeof(buf));
 		assert(len > 0);
-		struct inotify_event* event = (struct inotify_event*)buf;
-		int i;
-		for(i=0;i<len/sizeof(struct inotify_event);++i) {
-			if(strcmp("rules",event[i].name)) {
-				// config changed, reparse
-				goto REPARSE;
-			}
+		ssize_t i;
+		struct inotify_event* event;
+		for(i=0;i<len;i += sizeof(struct inotify_event) + event->len) {
+			event = (struct inotify_event*)(buf+i);
+			// config changed, reparse whichever file it was
+			sources_changed(ino,event);
 		}
+		goto MAYBE_RUN_RULE;
   }
-  goto WAIT_FOR_CONFIG;
+  goto MAYBE_RUN_RULE;
+REAP:
+	jobs_reap(finished);
+	if(handover_wanted && !simulating) {
+		handover();
+	}
+	goto MAYBE_RUN_RULE;
 RUN_RULE:
-  { if(space == 0) {
+  { if(queue_num == 0) {
 			warn("All rules disabled");
 			left.tv_sec = 10;
 			left.tv_nsec = 0;
 			goto WAIT_FOR_CONFIG;
 		}
 		
-		clock_gettime(CLOCK_REALTIME,&now);
-		//warn("cur %d now %d",r[cur].due.tv_sec,now.tv_sec);
-		if(r[0].due.tv_sec <= now.tv_sec ||
-       r[0].due.tv_sec == now.tv_sec &&
-			 r[0].due.tv_nsec <= now.tv_nsec) {
-			int res;
-			if(r[0].disabled)
+		getnow(&now);
+		if(simulating && simulate_done()) {
+			simulate_report();
+			return 0;
+		}
+		r = queue[0];
+		if(r->due.tv_sec <= now.tv_sec ||
+       r->due.tv_sec == now.tv_sec &&
+			 r->due.tv_nsec <= now.tv_nsec) {
+			if(jobs_num >= jobs_max) {
+				// wait for one to finish
+				goto WAIT_FOR_CONFIG;
+			}
+			if(r->disabled) {
+				// paused, so leave it be until it's resumed
+				queue_park(r);
 				goto RUN_RULE;
-			warn("running command: %s",r[0].name);
-		RETRY_RULE:    
-			res = mysystem(r[0].command);
-			fflush(stdout);
-			if(WIFSIGNALED(res)) {
-				warn("died with %hhd (%s)",WTERMSIG(res),strsignal(WTERMSIG(res)));
-			} else if(WIFEXITED(res)) {
-				if (0 == WEXITSTATUS(res)) {
-					// okay, it exited fine, update due and run the next rule
-					clock_gettime(CLOCK_REALTIME,&now);
-					update_due_adjust(r,space,0,&now);
-					goto RUN_RULE;
-				} else {
-					warn("exited with %hhd",r[0].command,WEXITSTATUS(res));
-				}
-			} else {
-				error("command neither exited or died? WTF??? %d",res);
 			}
-			clock_gettime(CLOCK_REALTIME,&now);
-			if(r[0].retried == 0) {
-				interval_between(&r[0].interval,&r[0].interval,&r[0].failing);
-				warn("slowing down to %d %s",
-						 interval_secs_from(&now,&r[0].interval),
-						 interval_tostr(&r[0].interval));
-				r[0].retried = r[0].retries;
-			} else {
-				--r[0].retried;
+			if(!lease_claim(r)) {
+				// another instance has it, lease_claim says when to check back
+				info("%s belongs to another instance",rule_name(r));
+				queue_adjust(r);
+				goto RUN_RULE;
 			}
-			update_due_adjust(r,space,0,&now);
+			warn("running command: %s",rule_name(r));
+			job_start(r,&now);
+			// not due again until it's finished
+			queue_park(r);
+			goto RUN_RULE;
 		} else {
 			goto WAIT_FOR_CONFIG; 
 		}
-		goto RUN_RULE;
   }
   return 0;
 }
@@ -1,99 +1,198 @@
 #include "parse.h"
 #include "errors.h"
-#include <ctype.h> // isspace
-#include <string.h> // strcmp
-#define AT_END (i == ctx->len)
+#include <string.h> // memset, strlen
 
 bool unimportant(char c) {
-  return c == ',' || isspace(c);
+  return c == ',' || c == ' ' || c == '\t' || c == '\n' || c == '\r';
 }
 
-bool next_token(struct parser* ctx) {
-  ssize_t i;
+enum unit { NOUNIT, SECOND, MINUTE, HOUR, DAY, WEEK, MONTH, YEAR };
+
+static const struct {
+	enum unit unit;
+	const char* spelling;
+} spellings[] = {
+	{ SECOND, "s" }, { SECOND, "sec" }, { SECOND, "secs" },
+	{ SECOND, "second" }, { SECOND, "seconds" },
+	{ MINUTE, "m" }, { MINUTE, "min" }, { MINUTE, "mins" },
+	{ MINUTE, "minute" }, { MINUTE, "minutes" },
+	{ HOUR, "h" }, { HOUR, "hr" }, { HOUR, "hrs" },
+	{ HOUR, "hour" }, { HOUR, "hours" },
+	{ DAY, "d" }, { DAY, "day" }, { DAY, "days" },
+	{ WEEK, "w" }, { WEEK, "wk" }, { WEEK, "wks" },
+	{ WEEK, "week" }, { WEEK, "weeks" },
+	{ MONTH, "mo" }, { MONTH, "mos" }, { MONTH, "mon" }, { MONTH, "mons" },
+	{ MONTH, "month" }, { MONTH, "months" },
+	{ YEAR, "y" }, { YEAR, "yr" }, { YEAR, "yrs" },
+	{ YEAR, "year" }, { YEAR, "years" }
+};
+
+/* the spellings as a trie, which is a DFA since no spelling needs lookahead.
+	 State 0 is the start, and nothing goes back to it, so 0 also means no such
+	 unit. Built the first time it's needed. */
+#define STATES 0x40
+#define DEAD 0
+static unsigned char transitions[STATES][26];
+static unsigned char accepts[STATES];
+static bool built = false;
+
+static void build(void) {
+	size_t i, nstates = 1;
+	for(i=0;i<sizeof(spellings)/sizeof(*spellings);++i) {
+		const char* c;
+		unsigned char state = 0;
+		for(c=spellings[i].spelling;*c;++c) {
+			unsigned char* next = &transitions[state][*c - 'a'];
+			if(*next == DEAD) {
+				assert(nstates < STATES);
+				*next = nstates++;
+			}
+			state = *next;
+		}
+		accepts[state] = spellings[i].unit;
+	}
+	built = true;
+}
+
+static int letter(char c) {
+	c |= 0x20; // lowercase, if it's a letter
+	if(c < 'a' || c > 'z') return -1;
+	return c - 'a';
+}
+
+// days in the fraction of a month that's left over
+#define MONTH_DAYS 30
+
+/* whole units go in their own field, and what's left over carries into the
+	 next smaller one, so 1.5 hours is 1 hour, 30 minutes. Seconds round. */
+static void add(struct tm* dest, enum unit unit, double amount) {
+	// 0.7 hours shouldn't end up 41 minutes, 59.99999 seconds
+	const double fuzz = 1e-9;
+	// amounts are never negative, so truncating is flooring
+	double whole = (long long)(amount + fuzz);
+	double part = amount - whole;
+	if(part < fuzz) part = 0;
+	switch(unit) {
+	case SECOND:
+		dest->tm_sec += whole + (part >= 0.5 ? 1 : 0);
+		return;
+	case MINUTE:
+		dest->tm_min += whole;
+		if(part) add(dest,SECOND,part * 60);
+		return;
+	case HOUR:
+		dest->tm_hour += whole;
+		if(part) add(dest,MINUTE,part * 60);
+		return;
+	case DAY:
+		dest->tm_mday += whole;
+		if(part) add(dest,HOUR,part * 24);
+		return;
+	case WEEK:
+		add(dest,DAY,amount * 7);
+		return;
+	case MONTH:
+		dest->tm_mon += whole;
+		if(part) add(dest,DAY,part * MONTH_DAYS);
+		return;
+	case YEAR:
+		dest->tm_year += whole;
+		if(part) add(dest,MONTH,part * 12);
+		return;
+	default:
+		return;
+	};
+}
 
-  for(i=ctx->start+ctx->tokenlen;i<ctx->len;++i) {
-	char c = ctx->s[i];
-#define ADVANCE(full) advance(full+1,sizeof(full)-2)
-	bool advance(const char* full, ssize_t len) {
-	  if(0!=strncasecmp(ctx->s+i,full,len))
+bool next_token(struct parser* ctx) {
+	if(!built) build();
+	ssize_t i = ctx->start + ctx->tokenlen;
+	// skip to the next token
+	while(i < ctx->len && unimportant(ctx->s[i])) ++i;
+	ctx->start = i;
+	ctx->tokenlen = 0;
+	if(i == ctx->len) {
+		if(ctx->state == SEEKUNIT) {
+			ctx->problem = "a number without a unit";
+			return false;
+		}
+		ctx->problem = NULL;
 		return false;
-	  i += len;
-	  if(i<ctx->len && ctx->s[i] == 's')
-		++i;
-	  return true;
 	}
-	switch(ctx->state) {
-	case SEEKNUM:
-	  if(unimportant(c)) continue;
-	  if(isdigit(c) || c == '.') {
-		ctx->gotdot = (c == '.');
+	if(ctx->state == SEEKNUM) {
 		ctx->state = FINISHNUM;
-		ctx->start = i;
-	  }
-	  continue;
-	case FINISHNUM:
-	  if(isdigit(c)) continue;
-	  if(c == '.' && !ctx->gotdot) {
-		ctx->gotdot = true;
-		continue;
-	  }
-	  ctx->amount = strtod(ctx->s+ctx->start,NULL);
-	  ctx->state = SEEKUNIT;
-	  ctx->tokenlen = i - ctx->start;
-	  return true;
-	case SEEKUNIT:
-	  if(unimportant(c)) continue;
-#define DONE ctx->state = SEEKNUM; \
-	  ctx->tokenlen = i-ctx->start;		  \
+		double amount = 0, scale = 1;
+		bool digits = false, dot = false;
+		for(;i < ctx->len;++i) {
+			char c = ctx->s[i];
+			if(c >= '0' && c <= '9') {
+				digits = true;
+				if(dot) {
+					scale /= 10;
+					amount += (c - '0') * scale;
+				} else {
+					amount = amount * 10 + (c - '0');
+				}
+			} else if(c == '.' && !dot) {
+				dot = true;
+			} else {
+				break;
+			}
+		}
+		ctx->tokenlen = i - ctx->start;
+		if(!digits) {
+			ctx->problem = "expected a number";
+			return false;
+		}
+		ctx->amount = amount;
+		ctx->state = SEEKUNIT;
 		return true;
+	}
+	ctx->state = FINISHUNIT;
+	unsigned char state = 0;
+	bool dead = false;
+	for(;i < ctx->len;++i) {
+		int c = letter(ctx->s[i]);
+		if(c < 0) break;
+		// once it's dead it stays dead, but keep going to the end of the word
+		if(!dead) {
+			state = transitions[state][c];
+			dead = state == DEAD;
+		}
+	}
+	ctx->tokenlen = i - ctx->start;
+	if(ctx->tokenlen == 0 || dead || accepts[state] == NOUNIT) {
+		ctx->problem = "not a unit";
+		return false;
+	}
+	add(&ctx->interval,accepts[state],ctx->amount);
+	ctx->state = SEEKNUM;
+	return true;
+}
 
-	  ctx->start = i;
-	  switch(c) {
-#define ONE(lower,upper,advance,what)				\
-		case lower:									\
-	  case upper:									\
-		if(AT_END) {								\
-		  ctx->interval.tm_ ## what = ctx->amount;	\
-		  DONE;										\
-		}											\
-	  ++i;											\
-	  if(unimportant(ctx->s[i]) || advance) {		\
-		ctx->interval.tm_ ## what += ctx->amount;	\
-		DONE;										\
-	  } else {										\
-		error("bad unit %s at %d\n",ctx->s+i,i);	\
-	  }
-		ONE('s','S',ADVANCE("second") || ADVANCE("sec"),sec);
-		// minute
-		ONE('h','H',ADVANCE("hour"),hour);
-		ONE('d','D',ADVANCE("day"),mday);
-		// month
-		ONE('y','Y',ADVANCE("year") || ADVANCE("yr"),year);
-		case 'm':
-		case 'M':
-		  ++i;
-		  if(AT_END || unimportant(ctx->s[i]) ||
-		  /* advance the full one first, so it won't leave "ute" unparsed. */
-			 ADVANCE("minute") ||
-			 ADVANCE("min")) {
-			ctx->interval.tm_min += ctx->amount;
-			DONE;
-		  } else if(ADVANCE("months") ||
-					ADVANCE("mon") ||
-					ADVANCE("mo")) {
-			ctx->interval.tm_mon += ctx->amount;
-			DONE;
-		  } else {
-			error("bad unit %s at %d\n",ctx->s+i,i);
-		  }
-		default:
-		  error("not a unit %s at %d\n",ctx->s+i,i);
-	  };
+bool parse_interval_r(struct tm* dest, const char* s, ssize_t len,
+											const char** problem) {
+  struct parser ctx = {
+		.s = s,
+		.len = len,
+  };
+	while(next_token(&ctx)) {
+		// add() already put it in ctx.interval
+	}
+	if(ctx.problem) {
+		if(problem) *problem = ctx.problem;
+		return false;
 	}
-  }
-  // at end... do we have a good enough state for one more token?
-  if(ctx->state != SEEKUNIT) return false;
-  ctx->tokenlen = ctx->len - ctx->start;
-  return true;
+	// intervals are NOT valid times, gmtime_r(0,&this) makes a different result
+	memcpy(dest,&ctx.interval,sizeof(*dest));
+	return true;
 }
 
+void parse_interval(struct tm* dest,
+										const char* s,
+										ssize_t len) {
+	const char* problem = NULL;
+	if(!parse_interval_r(dest,s,len,&problem)) {
+		error("bad interval \"%.*s\": %s",(int)len,s,problem);
+	}
+}
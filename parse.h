@@ -1,17 +1,27 @@
 #include <stdlib.h>
 #include <stdbool.h>
+#include <sys/types.h> // ssize_t
 
 #include "calendar.h"
 
 struct parser {
   struct tm interval;
-  int amount; // pending unitless amount
+  double amount; // pending unitless amount
   enum { SEEKNUM, FINISHNUM, SEEKUNIT, FINISHUNIT } state;
   const char* s;
   ssize_t start;
   ssize_t tokenlen;
   ssize_t len;
-  bool gotdot;
+  // why next_token stopped early, NULL at the end
+  const char* problem;
 };
 
+/* one number or unit per call. Units are recognized by a DFA over their
+	 spellings, case insensitive, so each character is looked at once. */
 bool next_token(struct parser* ctx);
+
+// false if s isn't an interval, with why in *problem
+bool parse_interval_r(struct tm* dest, const char* s, ssize_t len,
+											const char** problem);
+// exits if s isn't an interval
+void parse_interval(struct tm* dest, const char* s, ssize_t len);
@@ -0,0 +1,114 @@
+#define _GNU_SOURCE
+#include "placement.h"
+#include "errors.h"
+#include <sys/prctl.h>
+#include <string.h> // strerror
+#include <strings.h> // strncasecmp
+#include <stdlib.h> // strtoul
+#include <stdio.h> // dprintf
+#include <ctype.h> // isspace
+#include <errno.h>
+
+// longer than this is surely a typo, and a nanosecond count has to fit a long
+#define TIMERSLACK_MAX 60e9
+
+bool placement_none(const struct placement* p) {
+	return !p->pinned && p->policy == SCHED_OTHER && p->timerslack == 0;
+}
+
+void placement_cpus(struct placement* p, const char* s, size_t len) {
+	if(len == 3 && 0 == strncasecmp(s,"all",3)) {
+		p->pinned = false;
+		CPU_ZERO(&p->cpus);
+		return;
+	}
+	cpu_set_t cpus;
+	CPU_ZERO(&cpus);
+	const char* end = s + len;
+	while(s < end) {
+		if(isspace(*s) || *s == ',') {
+			++s;
+			continue;
+		}
+		char* e;
+		unsigned long first = strtoul(s,&e,10), last;
+		if(e == s) goto BAD;
+		last = first;
+		if(e < end && *e == '-') {
+			s = e+1;
+			last = strtoul(s,&e,10);
+			if(e == s || last < first) goto BAD;
+		}
+		if(e > end || last >= CPU_SETSIZE) goto BAD;
+		for(;first<=last;++first) CPU_SET(first,&cpus);
+		s = e;
+	}
+	if(CPU_COUNT(&cpus) == 0) goto BAD;
+	p->cpus = cpus;
+	p->pinned = true;
+	return;
+BAD:
+	warn("ignoring cpus because it isn't a list of CPUs: %.*s",(int)len,end-len);
+}
+
+void placement_policy(struct placement* p, const char* s, size_t len) {
+#define IS(N) (len == sizeof(N)-1 && 0 == strncasecmp(s,N,len))
+	if(IS("idle")) {
+		p->policy = SCHED_IDLE;
+	} else if(IS("batch")) {
+		p->policy = SCHED_BATCH;
+	} else if(IS("normal") || IS("other")) {
+		p->policy = SCHED_OTHER;
+	} else {
+		warn("ignoring sched because it isn't idle, batch or normal: %.*s",
+				 (int)len,s);
+	}
+#undef IS
+}
+
+void placement_timerslack(struct placement* p, const char* s, size_t len) {
+	if(len == 7 && 0 == strncasecmp(s,"default",7)) {
+		p->timerslack = 0;
+		return;
+	}
+	char* e;
+	double amount = strtod(s,&e);
+	const char* end = s + len;
+	while(e < end && isspace(*e)) ++e;
+	size_t unit = end - e;
+	double scale;
+	if(unit == 0 || (unit == 2 && 0 == memcmp(e,"ns",2))) {
+		scale = 1;
+	} else if(unit == 2 && 0 == memcmp(e,"us",2)) {
+		scale = 1e3;
+	} else if(unit == 2 && 0 == memcmp(e,"ms",2)) {
+		scale = 1e6;
+	} else if(unit == 1 && *e == 's') {
+		scale = 1e9;
+	} else {
+		scale = -1;
+	}
+	// written this way so nan fails too
+	if(e == s || scale < 0 || !(amount >= 0 && amount * scale <= TIMERSLACK_MAX)) {
+		warn("ignoring timerslack because it isn't a time like 50ms, up to a minute: %.*s",
+				 (int)len,s);
+		return;
+	}
+	p->timerslack = amount * scale;
+}
+
+void placement_apply(const struct placement* p) {
+	// the log ring is the parent's, so straight to stderr (the log file)
+	if(p->pinned && 0 != sched_setaffinity(0,sizeof(p->cpus),&p->cpus)) {
+		dprintf(2,"couldn't set cpus: %s\n",strerror(errno));
+	}
+	if(p->policy != SCHED_OTHER) {
+		struct sched_param param = { .sched_priority = 0 };
+		if(0 != sched_setscheduler(0,p->policy,&param)) {
+			dprintf(2,"couldn't set sched: %s\n",strerror(errno));
+		}
+	}
+	if(p->timerslack && 0 != prctl(PR_SET_TIMERSLACK,p->timerslack,0,0,0)) {
+		dprintf(2,"couldn't set timerslack: %s\n",strerror(errno));
+	}
+}
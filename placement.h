@@ -0,0 +1,37 @@
+#ifndef PLACEMENT_H
+#define PLACEMENT_H
+
+#include <sched.h>
+#include <stdbool.h>
+#include <sys/types.h> // size_t
+
+/* where a rule's command runs, so batch stuff stays out of the way of whatever
+	 else the machine is for. cpus = 0-1,6 pins it to those CPUs, sched = idle or
+	 batch picks SCHED_IDLE or SCHED_BATCH, and timerslack = 50ms lets the kernel
+	 put off waking it up by that much so its wakeups get batched together. Like
+	 most settings, these carry on to later rules until changed, and cpus = all,
+	 sched = normal and timerslack = default go back to leaving them alone.
+
+	 A cpu_set_t is big, so rules point at one copy of each different placement
+	 in their file instead of having their own. */
+
+struct placement {
+	cpu_set_t cpus;
+	bool pinned;
+	// SCHED_OTHER leaves it as it is
+	int policy;
+	// nanoseconds, 0 to leave it as it is
+	unsigned long timerslack;
+};
+
+// nothing to change
+bool placement_none(const struct placement* p);
+// each of these warns and leaves p alone if it can't make sense of s
+void placement_cpus(struct placement* p, const char* s, size_t len);
+void placement_policy(struct placement* p, const char* s, size_t len);
+void placement_timerslack(struct placement* p, const char* s, size_t len);
+/* in the child, before exec. Complains to stderr if something doesn't take, but
+	 the command runs anyway. */
+void placement_apply(const struct placement* p);
+
+#endif /* PLACEMENT_H */
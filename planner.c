@@ -0,0 +1,171 @@
+#include "planner.h"
+#include "rules.h"
+#include "jobs.h" // struct job
+#include "errors.h"
+#include <string.h> // memset
+
+size_t planning = 0;
+
+// a minute at a time, for two days ahead
+#define BUCKET 60
+#define BUCKETS (2*24*60)
+// what a rule that doesn't compute much costs, in CPUs
+#define JOB_WEIGHT 0.25f
+// how much a new offset has to beat the old one by to move there
+#define STICKY 0.9f
+// how fast the averages follow new runs
+#define LEARN 0.3f
+
+#define tvsecs(t) ((t).tv_sec + (t).tv_usec / 1000000.0)
+
+static float cpu[BUCKETS];
+static float busy[BUCKETS];
+// the bucket now is in. Earlier ones get reused for the far future
+static time_t current = 0;
+
+static void advance(void) {
+	struct timespec now;
+	getnow(&now);
+	time_t bucket = now.tv_sec / BUCKET;
+	if(current == 0 || bucket - current >= BUCKETS) {
+		memset(cpu,0,sizeof(cpu));
+		memset(busy,0,sizeof(busy));
+	} else {
+		for(;current < bucket;++current) {
+			cpu[current % BUCKETS] = 0;
+			busy[current % BUCKETS] = 0;
+		}
+	}
+	current = bucket;
+}
+
+static bool ahead(time_t bucket) {
+	return bucket >= current && bucket < current + BUCKETS;
+}
+
+// nothing reads plans until some rule has slack, so nobody else pays for them
+static void load(struct rule* r) {
+	if(r->plan_loaded) return;
+	r->plan_loaded = true;
+	if(!rule_load_extra(r,"plan",&r->plan,sizeof(r->plan))) {
+		memset(&r->plan,0,sizeof(r->plan));
+	}
+}
+
+static size_t span(float took) {
+	return took / BUCKET + 1;
+}
+
+void planner_add(struct rule* r, time_t at) {
+	planner_forget(r);
+	if(!planning) return;
+	load(r);
+	if(r->plan.runs == 0) return;
+	advance();
+	r->footprint.at = at;
+	r->footprint.took = r->plan.took;
+	r->footprint.cpu = r->plan.cpu;
+	time_t bucket = at / BUCKET;
+	size_t i, n = span(r->footprint.took);
+	for(i=0;i<n;++i) {
+		if(!ahead(bucket+i)) continue;
+		cpu[(bucket+i) % BUCKETS] += r->footprint.cpu;
+		busy[(bucket+i) % BUCKETS] += 1;
+	}
+}
+
+void planner_forget(struct rule* r) {
+	if(r->footprint.at == 0) return;
+	advance();
+	time_t bucket = r->footprint.at / BUCKET;
+	size_t i, n = span(r->footprint.took);
+	for(i=0;i<n;++i) {
+		// the ones that already went by were cleared
+		if(!ahead(bucket+i)) continue;
+		size_t b = (bucket+i) % BUCKETS;
+		cpu[b] -= r->footprint.cpu;
+		busy[b] -= 1;
+		if(cpu[b] < 0) cpu[b] = 0;
+		if(busy[b] < 0) busy[b] = 0;
+	}
+	r->footprint.at = 0;
+}
+
+// the worst it would get, if r started at at
+static float peak(const struct rule* r, time_t at) {
+	time_t bucket = at / BUCKET;
+	size_t i, n = span(r->plan.took);
+	float worst = 0;
+	for(i=0;i<n;++i) {
+		if(!ahead(bucket+i)) continue;
+		size_t b = (bucket+i) % BUCKETS;
+		float load = cpu[b] + r->plan.cpu + (busy[b] + 1) * JOB_WEIGHT;
+		if(load > worst) worst = load;
+	}
+	return worst;
+}
+
+
+void planner_plan(struct rule* r, bool ran) {
+	if(!planning || interval_empty(&r->settings->slack)) return;
+	load(r);
+	if(r->plan.runs == 0) return;
+	planner_forget(r);
+	advance();
+	time_t due = r->due.tv_sec;
+	if(ran && !scheduled(&r->settings->schedule)) {
+		/* it started offset late last time, and its interval counts from when it
+			 finished, so take that back out or it drifts later every run */
+		struct timespec now;
+		getnow(&now);
+		due -= r->plan.offset;
+		if(due <= now.tv_sec) due = now.tv_sec + 1;
+	}
+	// the same as later_time, but from local time so it's exact
+	struct tm date;
+	localtime_r(&due,&date);
+	advance_interval(&date,&r->settings->slack);
+	date.tm_isdst = -1;
+	time_t slack = mktime(&date) - due;
+	if(slack > (BUCKETS/2) * BUCKET) slack = (BUCKETS/2) * BUCKET;
+
+	time_t best = 0, offset;
+	float lowest = peak(r,due);
+	for(offset=BUCKET;offset<=slack;offset+=BUCKET) {
+		float load = peak(r,due+offset);
+		if(load < lowest) {
+			lowest = load;
+			best = offset;
+		}
+	}
+	if(r->plan.offset > 0 && r->plan.offset <= slack &&
+		 lowest >= peak(r,due+r->plan.offset) * STICKY) {
+		// not enough better to be worth moving
+		best = r->plan.offset;
+	}
+	if(best != r->plan.offset) {
+		info("planning %s %lds late",rule_name(r),(long)best);
+		r->plan.offset = best;
+		rule_save_extra(r,"plan",&r->plan,sizeof(r->plan));
+	}
+	r->due.tv_sec = due + best;
+}
+
+void planner_learn(struct rule* r, const struct job* job) {
+	if(!planning) return;
+	load(r);
+	struct timespec took;
+	timespecsub(&took,&job->done,&job->started);
+	float secs = timespecsecs(took);
+	float used = tvsecs(job->usage.ru_utime) + tvsecs(job->usage.ru_stime);
+	float cpus = secs > 0 ? used / secs : 0;
+	if(r->plan.runs == 0) {
+		r->plan.took = secs;
+		r->plan.cpu = cpus;
+	} else {
+		r->plan.took += LEARN * (secs - r->plan.took);
+		r->plan.cpu += LEARN * (cpus - r->plan.cpu);
+	}
+	++r->plan.runs;
+	rule_save_extra(r,"plan",&r->plan,sizeof(r->plan));
+}
@@ -0,0 +1,52 @@
+#ifndef PLANNER_H
+#define PLANNER_H
+
+#include <stdbool.h>
+#include <stdint.h>
+#include <time.h>
+#include <sys/types.h> // size_t
+
+/* slack = 30 minutes lets a rule start up to that much later than it's due,
+	 and the planner picks when within that. It learns how long each rule takes
+	 and how many CPUs it keeps busy from its finished runs, keeps a timeline of
+	 what every queued and running rule is expected to need over the next couple
+	 of days, and starts a rule with slack wherever in its window the peak would
+	 be lowest. Once it has picked an offset, it sticks with it unless another is
+	 clearly better, so rules don't wander around from run to run. While any
+	 rule has slack, every rule is learned and goes on the timeline, since the
+	 ones without slack are what the others have to get out of the way of. Until
+	 then, nothing is learned and no rule's plan is even read. */
+
+// learned, and saved as .plan-<name> next to the due time
+struct plan {
+	// seconds, averaged over recent runs
+	float took;
+	// CPU seconds per second
+	float cpu;
+	// how much later than due it was last planned
+	int32_t offset;
+	uint32_t runs;
+};
+
+// what a rule has added to the timeline, so it can be taken back out exactly
+struct footprint {
+	time_t at;
+	float took;
+	float cpu;
+};
+
+// how many rules have slack
+extern size_t planning;
+
+struct rule;
+struct job;
+
+/* r->due was just worked out, maybe move it later. ran if it was worked out
+	 from when r last ran, which was already late by its last offset. */
+void planner_plan(struct rule* r, bool ran);
+void planner_learn(struct rule* r, const struct job* job);
+// put r on the timeline starting at at, or take it off
+void planner_add(struct rule* r, time_t at);
+void planner_forget(struct rule* r);
+
+#endif /* PLANNER_H */
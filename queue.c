@@ -0,0 +1,100 @@
+#include "queue.h"
+#include "errors.h"
+#include <stdlib.h> // realloc
+
+struct rule** queue = NULL;
+static size_t space = 0;
+size_t queue_num = 0;
+
+static void put(size_t i, struct rule* r) {
+	queue[i] = r;
+	r->queued = i;
+}
+
+static void sift_up(size_t i) {
+	struct rule* r = queue[i];
+	while(i > 0) {
+		size_t parent = (i-1)>>1;
+		if(!timespecbefore(&r->due,&queue[parent]->due)) break;
+		put(i,queue[parent]);
+		i = parent;
+	}
+	put(i,r);
+}
+
+static void sift_down(size_t i) {
+	struct rule* r = queue[i];
+	for(;;) {
+		size_t child = (i<<1)+1;
+		if(child >= queue_num) break;
+		if(child+1 < queue_num &&
+			 timespecbefore(&queue[child+1]->due,&queue[child]->due)) {
+			++child;
+		}
+		if(!timespecbefore(&queue[child]->due,&r->due)) break;
+		put(i,queue[child]);
+		i = child;
+	}
+	put(i,r);
+}
+
+void queue_push(struct rule* r) {
+	if(queue_num == space) {
+		/* faster to allocate in chunks */
+		space += 1<<8;
+		queue = realloc(queue,space*sizeof(*queue));
+		assert(queue);
+	}
+	put(queue_num++,r);
+	sift_up(r->queued);
+	if(!r->running) planner_add(r,r->due.tv_sec);
+}
+
+void queue_adjust(struct rule* r) {
+	size_t i = r->queued;
+	assert(i < queue_num && queue[i] == r);
+	// a running rule is on the timeline from when it started instead
+	if(!r->running) planner_add(r,r->due.tv_sec);
+	if(i > 0 && timespecbefore(&r->due,&queue[(i-1)>>1]->due)) {
+		sift_up(i);
+	} else {
+		sift_down(i);
+	}
+}
+
+void queue_remove(struct rule* r) {
+	size_t i = r->queued;
+	assert(i < queue_num && queue[i] == r);
+	planner_forget(r);
+	if(--queue_num == i) return;
+	put(i,queue[queue_num]);
+	queue_adjust(queue[i]);
+}
+
+void queue_park(struct rule* r) {
+	r->due.tv_sec = NEVER;
+	r->due.tv_nsec = 0;
+	queue_adjust(r);
+}
+
+void queue_trigger(struct rule* r, const struct timespec* now) {
+	if(r->running) {
+		// go again once it's done
+		r->retrigger = true;
+		return;
+	}
+	info("triggering %s",rule_name(r));
+	r->due = *now;
+	queue_adjust(r);
+}
+
+static size_t count_due(size_t i, const struct timespec* now) {
+	if(i >= queue_num) return 0;
+	// children are never due before their parent, so stop here
+	if(timespecbefore(now,&queue[i]->due)) return 0;
+	return 1 + count_due((i<<1)+1,now) + count_due((i<<1)+2,now);
+}
+
+size_t queue_due(const struct timespec* now) {
+	return count_due(0,now);
+}
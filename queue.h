@@ -0,0 +1,24 @@
+#ifndef QUEUE_H
+#define QUEUE_H
+
+#include "rules.h"
+
+/* all the rules from every set, as a binary heap on due, so the next one to run
+	 is always queue[0], and rescheduling a rule costs O(log n) no matter how
+	 many rules there are. */
+
+extern struct rule** queue;
+extern size_t queue_num;
+
+void queue_push(struct rule* r);
+void queue_remove(struct rule* r);
+// r->due changed, so move it to where it belongs now
+void queue_adjust(struct rule* r);
+// not due until something triggers it
+void queue_park(struct rule* r);
+// due now, or again as soon as it finishes if it's running
+void queue_trigger(struct rule* r, const struct timespec* now);
+// how many rules are due as of now
+size_t queue_due(const struct timespec* now);
+
+#endif /* QUEUE_H */
@@ -0,0 +1,668 @@
+#define _GNU_SOURCE
+#include "rules.h"
+#include "parse.h" // parse_interval_r
+#include "errors.h"
+#include "uring.h"
+#include <string.h> // memcpy
+#include <fcntl.h> // open, openat
+#include <sys/stat.h>
+#include <sys/mman.h>
+#include <unistd.h> // read, write
+#include <ctype.h> // isspace
+#include <stdio.h> // renameat, snprintf
+
+bool nowait = false;
+
+static const struct rule rule_defaults = {
+	.interval = { .tm_hour = 1 },
+	.lease = -1
+};
+
+void later_time(struct timespec* dest,
+								const struct tm* interval,
+								const struct timespec* base) {
+	struct tm date;
+  gmtime_r(&base->tv_sec,&date);
+  advance_interval(&date,interval);
+	dest->tv_sec = mymktime(date) + 1;
+	dest->tv_nsec = 0;
+	// have it happen at the BEGINNING of the second, or the END of the second?
+	// or at base->tv_nsec nanoseconds after the second?
+	// end is prettier
+}
+
+void rule_next_due(struct rule* r, const struct timespec* base, bool ran) {
+	if(!scheduled(&r->settings->schedule)) {
+		later_time(&r->due,&r->interval,base);
+	} else {
+		r->due.tv_nsec = 0;
+		if(!schedule_next(&r->settings->schedule,base->tv_sec,&r->due.tv_sec)) {
+			warn("%s is scheduled for a day that never comes",rule_name(r));
+			r->due.tv_sec = NEVER;
+			return;
+		}
+	}
+	// maybe a little later, if that's less busy
+	planner_plan(r,ran);
+}
+
+static bool save(int dir, const char* name, const void* data, size_t len) {
+	char temp[0x100];
+	snprintf(temp,sizeof(temp),".temp-%s",name);
+	int out = openat(dir,temp,O_WRONLY|O_CREAT|O_TRUNC,0644);
+	if(out < 0) return false;
+	ssize_t amt = write(out,data,len);
+	int closed = close(out);
+	if(closed == 0 && amt == len) {
+		int res = renameat(dir,temp,dir,name);
+		assert(0==res);
+		return true;
+	}
+	unlinkat(dir,temp,0);
+	return false;
+}
+
+void rule_save_due(struct rule* r) {
+	// don't clobber the real schedule with a pretend one
+	if(r->name == NULL || simulating) return;
+	// saved next time we go idle
+	if(uring && uring_save(r->set->dues,r->name,&r->due,sizeof(r->due))) return;
+	if(!save(r->set->dues,r->name,&r->due,sizeof(r->due))) {
+		warn("couldn't save due time for %s",r->name);
+	}
+}
+
+void rule_save_extra(struct rule* r, const char* what, const void* data, size_t len) {
+	if(r->name == NULL || simulating) return;
+	char name[0x100];
+	snprintf(name,sizeof(name),".%s-%s",what,r->name);
+	if(uring && uring_save(r->set->dues,name,data,len)) return;
+	if(!save(r->set->dues,name,data,len)) {
+		warn("couldn't save the %s of %s",what,r->name);
+	}
+}
+
+bool rule_load_extra(struct rule* r, const char* what, void* data, size_t len) {
+	if(r->name == NULL) return false;
+	char name[0x100];
+	snprintf(name,sizeof(name),".%s-%s",what,r->name);
+	int in = openat(r->set->dues,name,O_RDONLY);
+	if(in < 0) return false;
+	ssize_t amt = read(in,data,len);
+	close(in);
+	return amt == len;
+}
+
+void rule_save_fingerprint(struct rule* r, uint64_t fingerprint) {
+	r->fingerprint = fingerprint;
+	r->fingerprinted = true;
+	rule_save_extra(r,"inputs",&r->fingerprint,sizeof(r->fingerprint));
+}
+
+const char* rule_command(const struct rule* r) {
+	if(r->template) return template_command(r->template,r->instance);
+	return r->command;
+}
+
+char* rule_inputs(const struct rule* r) {
+	if(r->template) return template_fill(r->template,&r->template->inputs,r->instance);
+	return r->inputs ? strdup(r->inputs) : NULL;
+}
+
+const char* rule_name(const struct rule* r) {
+	static char buf[0x200];
+	const char* name = r->name ? r->name : "(unnamed)";
+	if(r->set == NULL || r->set->namespace[0] == '\0') return name;
+	snprintf(buf,sizeof(buf),"%s/%s",r->set->namespace,name);
+	return buf;
+}
+
+void ruleset_clear(struct ruleset* set) {
+	size_t i;
+	for(i=0;i<set->num;++i) {
+		if(!interval_empty(&set->rules[i].settings->slack)) --planning;
+		// those are the template's
+		if(set->rules[i].template == NULL) {
+			free(set->rules[i].name);
+			free(set->rules[i].command);
+			free(set->rules[i].after);
+			free(set->rules[i].after_success);
+			free(set->rules[i].inputs);
+		}
+		free(set->rules[i].dependents);
+	}
+	free(set->rules);
+	set->rules = NULL;
+	set->num = 0;
+	free(set->index);
+	set->index = NULL;
+	set->nindex = 0;
+	for(i=0;i<set->ntemplates;++i) {
+		template_free(set->templates[i]);
+	}
+	free(set->templates);
+	set->templates = NULL;
+	set->ntemplates = 0;
+	for(i=0;i<set->nplacements;++i) {
+		free(set->placements[i]);
+	}
+	free(set->placements);
+	set->placements = NULL;
+	set->nplacements = 0;
+	for(i=0;i<set->nsettings;++i) {
+		free(set->settings[i]);
+	}
+	free(set->settings);
+	set->settings = NULL;
+	set->nsettings = 0;
+}
+
+// one copy of each, for every rule that has it
+static const struct placement* intern_placement(struct ruleset* set,
+																								const struct placement* p) {
+	if(placement_none(p)) return NULL;
+	size_t i;
+	for(i=0;i<set->nplacements;++i) {
+		if(0 == memcmp(set->placements[i],p,sizeof(*p))) return set->placements[i];
+	}
+	set->placements = realloc(set->placements,
+														(set->nplacements+1)*sizeof(*set->placements));
+	set->placements[set->nplacements] = malloc(sizeof(*p));
+	memcpy(set->placements[set->nplacements],p,sizeof(*p));
+	return set->placements[set->nplacements++];
+}
+
+// a bad interval only costs that setting, not the daemon every other file shares
+static void setting_interval(struct tm* dest, const char* name, int nlen,
+														 const char* value, int len) {
+	const char* problem = NULL;
+	if(!parse_interval_r(dest,value,len,&problem)) {
+		warn("ignoring %.*s because it isn't an interval (%s): %.*s",
+				 nlen,name,problem,len,value);
+	}
+}
+
+// the same, but newest first, since rules mostly keep the settings before them
+static const struct settings* intern_settings(struct ruleset* set,
+																							const struct settings* s) {
+	size_t i;
+	for(i=set->nsettings;i>0;--i) {
+		if(0 == memcmp(set->settings[i-1],s,sizeof(*s))) return set->settings[i-1];
+	}
+	set->settings = realloc(set->settings,
+													(set->nsettings+1)*sizeof(*set->settings));
+	set->settings[set->nsettings] = malloc(sizeof(*s));
+	memcpy(set->settings[set->nsettings],s,sizeof(*s));
+	return set->settings[set->nsettings++];
+}
+
+static int by_name(const void* a, const void* b) {
+	return strcmp((*(struct rule**)a)->name,(*(struct rule**)b)->name);
+}
+
+struct rule* ruleset_find(struct ruleset* set, const char* name) {
+	struct rule key = { .name = (char*)name };
+	struct rule* pkey = &key;
+	struct rule** found = bsearch(&pkey,set->index,set->nindex,
+																sizeof(*set->index),by_name);
+	return found ? *found : NULL;
+}
+
+static void add_dependencies(struct ruleset* set, struct rule* child, bool success) {
+	// instances fill in their own values
+	const struct template* t = child->template;
+	char* names = t ?
+		template_fill(t,success ? &t->after_success : &t->after,child->instance) :
+		strdup(success ? child->after_success : child->after);
+	char* save = NULL;
+	char* name;
+	for(name=strtok_r(names," \t,",&save);name;name=strtok_r(NULL," \t,",&save)) {
+		struct rule* parent = ruleset_find(set,name);
+		if(parent == NULL || parent == child) {
+			warn("%s is after %s, which isn't another rule in %s",
+					 rule_name(child),name,child->set->path);
+			continue;
+		}
+		parent->dependents = realloc(parent->dependents,
+																 (parent->ndependents+1)*sizeof(struct dependent));
+		parent->dependents[parent->ndependents].rule = child;
+		parent->dependents[parent->ndependents].success = success;
+		++parent->ndependents;
+	}
+	free(names);
+}
+
+enum { UNSEEN, VISITING, DONE };
+
+static void break_cycles(struct ruleset* set, char* state, struct rule* r) {
+	state[r - set->rules] = VISITING;
+	size_t i;
+	for(i=0;i<r->ndependents;) {
+		struct rule* child = r->dependents[i].rule;
+		switch(state[child - set->rules]) {
+		case VISITING:
+			warn("dependency cycle: %s can't be after %s",
+					 rule_name(child),rule_name(r));
+			r->dependents[i] = r->dependents[--r->ndependents];
+			continue;
+		case UNSEEN:
+			break_cycles(set,state,child);
+		};
+		++i;
+	}
+	state[r - set->rules] = DONE;
+}
+
+/* index the rules by name, then turn after = names into dependents of those
+	 rules, now that every rule in the file is known. */
+static void resolve_dependencies(struct ruleset* set, const struct timespec* now) {
+	size_t i;
+	set->index = malloc(set->num * sizeof(*set->index));
+	for(i=0;i<set->num;++i) {
+		if(set->rules[i].name) set->index[set->nindex++] = set->rules + i;
+	}
+	qsort(set->index,set->nindex,sizeof(*set->index),by_name);
+	for(i=0;i<set->num;++i) {
+		struct rule* r = set->rules + i;
+		if(!r->triggered) continue;
+		if(r->after) {
+			add_dependencies(set,r,false);
+		}
+		if(r->after_success) {
+			add_dependencies(set,r,true);
+		}
+	}
+
+	char* state = calloc(set->num,1);
+	for(i=0;i<set->num;++i) {
+		if(state[i] == UNSEEN) break_cycles(set,state,set->rules+i);
+	}
+
+	// what's left after that is what can still trigger each rule
+	size_t* parents = calloc(set->num,sizeof(*parents));
+	for(i=0;i<set->num;++i) {
+		size_t j;
+		for(j=0;j<set->rules[i].ndependents;++j) {
+			++parents[set->rules[i].dependents[j].rule - set->rules];
+		}
+	}
+	for(i=0;i<set->num;++i) {
+		struct rule* r = set->rules + i;
+		if(r->triggered && parents[i] == 0) {
+			// nothing will ever trigger it, so just run it regularly
+			r->triggered = false;
+			rule_next_due(r,now,false);
+		}
+	}
+	free(parents);
+	free(state);
+}
+
+void ruleset_parse(struct ruleset* set) {
+	ruleset_clear(set);
+  int fd = open(set->path, O_RDONLY);
+  if(fd < 0) return;
+  struct stat file_info;
+  fstat(fd,&file_info);
+	if(file_info.st_size == 0) {
+		close(fd);
+		return;
+	}
+  const char* s = mmap(NULL, file_info.st_size,PROT_READ,MAP_PRIVATE,fd,0);
+	close(fd);
+  assert(s != MAP_FAILED);
+	struct rule default_rule = rule_defaults;
+	// the rest of what carries on to later rules. Zeroed for memcmp, like placement
+	struct settings settings;
+	memset(&settings,0,sizeof(settings));
+	settings.failing.tm_hour = 2;
+	memcpy(&settings.sim,&simulate_defaults,sizeof(settings.sim));
+	struct rule* ret = NULL;
+  size_t num = 0;
+	// foreach = lines so far, for the next command
+	struct template* template = NULL;
+	// failing = came up, and it doesn't default to off like retries does
+	bool failing_given = false;
+	// cpus = and friends so far. Zeroed, so it can be compared with memcmp
+	struct placement placement;
+	memset(&placement,0,sizeof(placement));
+  struct timespec now;
+  getnow(&now);
+  size_t i = 0;
+  while(i<file_info.st_size) {
+		// parse name=value pairs, committing with a command.
+		size_t start = i;
+		size_t eq = start;
+		bool goteq = false;
+		for(;;) {
+			if(s[i] == '\n') break;
+			if(s[i] == '=') {
+				eq = i;
+				goteq = true;
+			}
+			if(++i == file_info.st_size) {
+				//info("doesn't end in a newline");
+				break;
+			}
+		}
+		size_t sname = start;
+		size_t ename = eq;
+		size_t sval = eq+1;
+		size_t eval = i;
+	
+		bool is_a_command(void) {
+			if(sval >= eval) {
+				// newline
+				//info("newline");
+				return false;
+			}
+			//info("nanewline %d %d",sval,eval);
+			if(!goteq) {
+				--sval; // eq is start, so eq+1 is BAD
+				return true; // it's a command
+			}
+			for(;;) {
+				// strip trailing spaces from name
+				if(ename == start) {
+					// empty name means command
+					return true;
+				}
+				if(isspace(s[ename-1])) {
+					--ename;
+				} else {
+					break;
+				}
+			}
+			for(;;) {
+				// strip leading spaces from name
+				if(sname == ename) {
+					// empty name means command
+					return true;
+				}
+				if(isspace(s[sname])) {
+					++sname;
+				} else {
+					break;
+				}
+			}
+		
+			for(;;) {
+				// strip trailing spaces from value
+				if(eval == sval) {
+					warn("empty value for %.*s",(int)(ename-sname),s+sname);
+					return false; // still not a command
+				}
+				if(isspace(s[eval-1])) {
+					--eval;
+				} else {
+					break;
+				}
+			}
+		
+			for(;;) {
+				// strip leading spaces from value
+				if(sval == eval) {
+					warn("empty value for %.*s",(int)(ename-sname),s+sname);
+					return false; // still not a command
+				}
+				if(isspace(s[sval])) {
+					++sval;
+				} else {
+					break;
+				}
+			}
+
+			// not a command, but needs handling
+
+#define NAME_IS(N) (ename-sname == sizeof(N)-1 && 0==memcmp(s+sname,N,sizeof(N)-1))
+			if(ename-sname > 8 && 0 == memcmp(s+sname,"foreach",7) && isspace(s[sname+7])) {
+				size_t var = sname+8;
+				while(isspace(s[var])) ++var;
+				if(template == NULL) template = calloc(1,sizeof(*template));
+				template_var(template,s+var,ename-var,s+sval,eval-sval);
+				return false;
+			} else if(NAME_IS("name")) {
+				default_rule.name = realloc(default_rule.name,eval-sval+1);
+				memcpy(default_rule.name,s+sval,eval-sval);
+				default_rule.name[eval-sval] = '\0';
+				info("found name %s",default_rule.name);
+				return false;
+			} else if(NAME_IS("after") || NAME_IS("after_success")) {
+				char** names = NAME_IS("after") ?
+					&default_rule.after : &default_rule.after_success;
+				*names = realloc(*names,eval-sval+1);
+				memcpy(*names,s+sval,eval-sval);
+				(*names)[eval-sval] = '\0';
+				return false;
+			} else if(NAME_IS("wait") || NAME_IS("interval")) {
+				setting_interval(&default_rule.interval,s+sname,ename-sname,
+												 s+sval,eval-sval);
+				return false;
+			} else if(NAME_IS("retries")) {
+				// we know the end already is eval.
+				char* enumber = NULL;
+				// base == 0 allows for 0xFF and 0755 syntax
+				size_t retries = strtol(s+sval,&enumber,0);
+				if(enumber == s + eval) {
+					settings.retries = retries;
+				} else {
+					warn("ignoring retries because not a number: %.*s",
+							 (int)(eval-sval),s+sval);
+				}
+				return false;
+			} else if(NAME_IS("failing")) {
+				failing_given = true;
+				setting_interval(&settings.failing,s+sname,ename-sname,
+												 s+sval,eval-sval);
+				return false;
+			} else if(NAME_IS("inputs")) {
+				default_rule.inputs = realloc(default_rule.inputs,eval-sval+1);
+				memcpy(default_rule.inputs,s+sval,eval-sval);
+				default_rule.inputs[eval-sval] = '\0';
+				return false;
+			} else if(NAME_IS("hash_inputs")) {
+				settings.hash_inputs =
+					(eval-sval == 3 && 0 == strncasecmp(s+sval,"yes",3)) ||
+					(eval-sval == 4 && 0 == strncasecmp(s+sval,"true",4));
+				return false;
+			} else if(NAME_IS("slack")) {
+				setting_interval(&settings.slack,s+sname,ename-sname,
+												 s+sval,eval-sval);
+				return false;
+			} else if(NAME_IS("cpus")) {
+				placement_cpus(&placement,s+sval,eval-sval);
+				return false;
+			} else if(NAME_IS("sched")) {
+				placement_policy(&placement,s+sval,eval-sval);
+				return false;
+			} else if(NAME_IS("timerslack")) {
+				placement_timerslack(&placement,s+sval,eval-sval);
+				return false;
+			} else if(NAME_IS("at")) {
+				schedule_at(&settings.schedule,s+sval,eval-sval);
+				return false;
+			} else if(NAME_IS("days")) {
+				schedule_days(&settings.schedule,s+sval,eval-sval);
+				return false;
+			} else if(NAME_IS("dates")) {
+				schedule_dates(&settings.schedule,s+sval,eval-sval);
+				return false;
+			} else if(NAME_IS("tz") || NAME_IS("timezone")) {
+				schedule_tz(&settings.schedule,s+sval,eval-sval);
+				return false;
+			} else if(NAME_IS("sim_duration")) {
+				setting_interval(&settings.sim.duration,s+sname,ename-sname,
+												 s+sval,eval-sval);
+				return false;
+			} else if(NAME_IS("sim_failure")) {
+				char* enumber = NULL;
+				float failure = strtof(s+sval,&enumber);
+				if(enumber == s + eval) {
+					settings.sim.failure = failure;
+				} else {
+					warn("ignoring sim_failure because not a number: %.*s",
+							 (int)(eval-sval),s+sval);
+				}
+				return false;
+			}
+			// assume the command contains an '=' sign and this line isn't a n=v pair
+			return true;
+		}
+
+		if(is_a_command()) {
+			// use sval and eval because might be command= or just a leading =
+			
+			{
+				
+				time_t a = interval_secs_from(&now, &default_rule.interval);
+				time_t b = interval_secs_from(&now, &settings.failing);
+				// sanity check
+				if(b < a) {
+					char normal[0x100];
+					char failing[0x100];
+					interval_tostr_r(&settings.failing, failing, 0x100);
+					interval_tostr_r(&default_rule.interval, normal, 0x100);
+					warn("failing set to lower than normal wait time... %ld '%s' < %ld '%s' adjusting.",
+							 b,
+							 failing,
+							 a,
+							 normal);
+					interval_mul(&settings.failing, &default_rule.interval, 2);
+				}
+			}
+			if(scheduled(&settings.schedule) &&
+				 (settings.retries || failing_given)) {
+				warn("%s: retries and failing are ignored for rules with at, days or dates,"
+						 " like %.*s",set->path,(int)(eval-sval),s+sval);
+			}
+
+			void commit(void) {
+				if(num%(1<<8)==0) {
+					/* faster to allocate in chunks */
+					ret = realloc(ret,(num+(1<<8))*sizeof(struct rule));
+				}
+				
+				default_rule.set = set;
+				settings.placement = intern_placement(set,&placement);
+				default_rule.settings = intern_settings(set,&settings);
+				if(default_rule.inputs) {
+					default_rule.fingerprinted =
+						rule_load_extra(&default_rule,"inputs",&default_rule.fingerprint,
+														sizeof(default_rule.fingerprint));
+				}
+				default_rule.triggered =
+					default_rule.after != NULL || default_rule.after_success != NULL;
+				if(default_rule.triggered) {
+					// waits for what it's after
+					default_rule.due.tv_sec = NEVER;
+					default_rule.due.tv_nsec = 0;
+				} else if(nowait) {
+					// just make everything due on startup
+					memcpy(&default_rule.due,&now,sizeof(now));
+				} else {
+					void setdue() {
+						struct timespec saved;
+						bool have = false;
+						if(default_rule.name) {
+							// maybe deserialize
+							int in = openat(set->dues,default_rule.name,O_RDONLY);
+							if(in >= 0) {
+								ssize_t amt = read(in, &saved, sizeof(saved));
+								close(in);
+								have = sizeof(saved) == amt;
+							}
+						}
+						if(have && !scheduled(&settings.schedule)) {
+							default_rule.due = saved;
+							return;
+						}
+						rule_next_due(&default_rule,&now,false);
+						/* a missed time still runs (it's in the past), but one that moved
+							 earlier shouldn't wait for where it used to be */
+						if(have && timespecbefore(&saved,&default_rule.due)) {
+							default_rule.due = saved;
+						}
+					}
+					setdue();
+				}
+				memcpy(ret+num,&default_rule,sizeof(struct rule));
+				++num;
+				// working out its due time may have read its plan, which was its own
+				default_rule.plan_loaded = false;
+				memset(&default_rule.plan,0,sizeof(default_rule.plan));
+				if(!interval_empty(&settings.slack)) ++planning;
+			}
+
+			if(template && template->count) {
+				/* the instances share the template's command, its block of names, and
+					 the rest of the strings they'd otherwise each have a copy of */
+				template->after.text = default_rule.after;
+				template->after_success.text = default_rule.after_success;
+				template->inputs.text = default_rule.inputs;
+				char** names = NULL;
+				if(default_rule.name) names = malloc(template->count*sizeof(*names));
+				template_finish(template,s+sval,eval-sval,default_rule.name,names);
+				free(default_rule.name);
+				set->templates = realloc(set->templates,
+																 (set->ntemplates+1)*sizeof(*set->templates));
+				set->templates[set->ntemplates++] = template;
+				default_rule.template = template;
+				size_t instance;
+				for(instance=0;instance<template->count;++instance) {
+					default_rule.instance = instance;
+					default_rule.name = names ? names[instance] : NULL;
+					commit();
+				}
+				free(names);
+			} else if(template) {
+				// every foreach was bad, so there's nothing to run
+				template_free(template);
+				free(default_rule.name);
+				free(default_rule.after);
+				free(default_rule.after_success);
+				free(default_rule.inputs);
+			} else {
+				default_rule.command = malloc(eval-sval+1);
+				memcpy(default_rule.command,s+sval,eval-sval);
+				default_rule.command[eval-sval] = '\0';
+				// we're not gonna mess with shell parsing... just pass to the shell.
+				commit();
+			}
+			template = NULL;
+
+			// any n=v pairs now committed to the current rule.
+			// further rules will use the same values unless specified
+
+			// be sure to transfer ownership of the name pointer. (move semantics)
+			default_rule.name = NULL;
+			default_rule.command = NULL;
+			default_rule.template = NULL;
+			default_rule.instance = 0;
+			default_rule.after = NULL;
+			default_rule.after_success = NULL;
+			default_rule.inputs = NULL;
+			settings.hash_inputs = false;
+			default_rule.fingerprinted = false;
+			// the zone carries on to later rules, but not the times
+			settings.schedule.nat = 0;
+			memset(settings.schedule.at,0,sizeof(settings.schedule.at));
+			settings.schedule.days = 0;
+			settings.schedule.dates = 0;
+		}
+		++i;
+  }
+  munmap((void*)s,file_info.st_size);
+	free(default_rule.name);
+	free(default_rule.after);
+	free(default_rule.after_success);
+	free(default_rule.inputs);
+	if(template) {
+		warn("%s: foreach without a command after it",set->path);
+		template_free(template);
+	}
+  // now we don't need the trailing chunk
+	set->rules = realloc(ret,num*sizeof(struct rule));
+	set->num = num;
+	resolve_dependencies(set,&now);
+	info("%s: %zu rules",set->path,num);
+}
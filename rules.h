@@ -0,0 +1,135 @@
+#ifndef RULES_H
+#define RULES_H
+
+#include "calendar.h"
+#include "simulate.h"
+#include "schedule.h"
+#include "planner.h"
+#include "template.h"
+#include "placement.h"
+#include <stdint.h>
+#include <sys/types.h> // ssize_t
+
+struct ruleset;
+
+// due time of rules that only run when triggered
+#define NEVER ((time_t)(((uint64_t)1 << (sizeof(time_t)*8-1)) - 1))
+
+struct dependent {
+	struct rule* rule;
+	// only when the one it's after succeeds
+	bool success;
+};
+
+/* what a rule was given that stays put while it runs. Rules with the same
+	 settings (every instance of a template, and most neighbours, since settings
+	 carry on to the next rule) share one copy. */
+struct settings {
+	struct tm failing;
+	// how much later than due it may start, for the planner
+	struct tm slack;
+	struct simulated sim;
+	// at = and friends, instead of the interval
+	struct schedule schedule;
+	// cpus =, sched = and timerslack =, NULL if none of them
+	const struct placement* placement;
+	uint8_t retries;
+	bool hash_inputs;
+};
+
+struct rule {
+	// this one changes while it's failing, so it isn't with the settings
+  struct tm interval;
+	const struct settings* settings;
+	uint8_t retried;
+  struct timespec due;
+  // NULL if it comes from a template
+  char* command;
+  // foreach =, and which of its instances this is
+  struct template* template;
+  size_t instance;
+  bool disabled;
+	char* name;
+	struct ruleset* set;
+	// where in the queue this rule is
+	size_t queued;
+	// lock held while running it, when sharing rules between instances
+	int lease;
+	bool running;
+	// runs when a rule it's after finishes, instead of on its own
+	bool triggered;
+	// triggered again while it was still running
+	bool retrigger;
+	// rules to run when this one finishes
+	struct dependent* dependents;
+	size_t ndependents;
+	// its name is in history/names
+	bool journaled;
+	// read in the first time the planner needs it
+	bool plan_loaded;
+	struct plan plan;
+	struct footprint footprint;
+	// inputs =, NULL to run whether they changed or not
+	char* inputs;
+	bool fingerprinted;
+	// of the inputs, as of its last successful run
+	uint64_t fingerprint;
+	// rule names from after = and after_success =, until they're resolved
+	char* after;
+	char* after_success;
+};
+
+/* every rules file gets its own set, so rule names only have to be unique
+	 within their file, and reloading one file doesn't disturb the others. */
+struct ruleset {
+	char* path;
+	// "" for the main rules file, so its dues stay where they always were
+	char* namespace;
+	// directory the due times for these rules are saved in
+	int dues;
+	struct rule* rules;
+	size_t num;
+	// the named ones, sorted by name
+	struct rule** index;
+	size_t nindex;
+	// every different placement and settings the rules have
+	struct placement** placements;
+	size_t nplacements;
+	struct settings** settings;
+	size_t nsettings;
+	// foreach = rules, which their rules' names and commands belong to
+	struct template** templates;
+	size_t ntemplates;
+	// inotify watch on the directory path is in
+	int watch;
+};
+
+extern bool nowait;
+
+// (re)read set->path into set->rules. Doesn't touch the queue.
+void ruleset_parse(struct ruleset* set);
+void ruleset_clear(struct ruleset* set);
+// the rule called name in set, or NULL
+struct rule* ruleset_find(struct ruleset* set, const char* name);
+
+void later_time(struct timespec* dest,
+								const struct tm* interval,
+								const struct timespec* base);
+/* when r runs next, if it was last due at base. ran if base is when it last
+	 finished, rather than just now. */
+void rule_next_due(struct rule* r, const struct timespec* base, bool ran);
+void rule_save_due(struct rule* r);
+/* other things to keep next to a rule's due time, in .<what>-<name>. Not saved
+	 for unnamed rules, or when simulating. */
+void rule_save_extra(struct rule* r, const char* what, const void* data, size_t len);
+bool rule_load_extra(struct rule* r, const char* what, void* data, size_t len);
+// the current run succeeded, so remember what its inputs were
+void rule_save_fingerprint(struct rule* r, uint64_t fingerprint);
+// what to run, filled in from its template if need be. Overwritten every call.
+const char* rule_command(const struct rule* r);
+// inputs =, filled in from its template if need be, to free. NULL if none
+char* rule_inputs(const struct rule* r);
+// namespace/name, for messages. Overwritten every call.
+const char* rule_name(const struct rule* r);
+
+#endif /* RULES_H */
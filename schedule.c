@@ -0,0 +1,360 @@
+#define _GNU_SOURCE
+#include "schedule.h"
+#include "errors.h"
+#include <string.h> // strncasecmp, strndup
+#include <stdlib.h> // setenv
+#include <unistd.h> // access
+#include <stdio.h> // asprintf
+#include <ctype.h> // isdigit
+
+// give up on a schedule that hasn't fired in this many months
+#define MONTHS_MAX (12*400)
+
+static bool separator(char c) {
+	return c == ',' || c == ' ' || c == '\t';
+}
+
+// the next word in s, split by commas and spaces
+static bool word(const char* s, size_t len, size_t* start, size_t* end) {
+	size_t i = *end;
+	while(i < len && separator(s[i])) ++i;
+	if(i == len) return false;
+	*start = i;
+	while(i < len && !separator(s[i])) ++i;
+	*end = i;
+	return true;
+}
+
+static bool number(const char* s, size_t len, int* n) {
+	size_t i;
+	*n = 0;
+	if(len == 0) return false;
+	for(i=0;i<len;++i) {
+		if(!isdigit(s[i])) return false;
+		*n = *n * 10 + s[i] - '0';
+	}
+	return true;
+}
+
+static int by_time(const void* a, const void* b) {
+	return *(const int32_t*)a - *(const int32_t*)b;
+}
+
+bool schedule_at(struct schedule* sched, const char* s, size_t len) {
+	size_t start, end = 0;
+	sched->nat = 0;
+	while(word(s,len,&start,&end)) {
+		// HH:MM or HH:MM:SS
+		int parts[3] = {};
+		int nparts = 0;
+		size_t i = start;
+		while(nparts < 3) {
+			size_t j = i;
+			while(j < end && s[j] != ':') ++j;
+			if(!number(s+i,j-i,&parts[nparts++])) goto BAD;
+			if(j == end) break;
+			i = j+1;
+		}
+		if(nparts < 2 || parts[0] > 23 || parts[1] > 59 || parts[2] > 59) goto BAD;
+		if(sched->nat == SCHEDULE_TIMES) {
+			warn("only %d times allowed in at = %.*s",SCHEDULE_TIMES,(int)len,s);
+			return false;
+		}
+		sched->at[sched->nat++] = parts[0]*3600 + parts[1]*60 + parts[2];
+	}
+	qsort(sched->at,sched->nat,sizeof(*sched->at),by_time);
+	return true;
+BAD:
+	warn("at = %.*s isn't a list of HH:MM times",(int)len,s);
+	sched->nat = 0;
+	return false;
+}
+
+static const char* weekdays[] = {
+	"sunday", "monday", "tuesday", "wednesday", "thursday", "friday", "saturday"
+};
+
+static int weekday(const char* s, size_t len) {
+	int i;
+	if(len < 3) return -1;
+	for(i=0;i<7;++i) {
+		if(len <= strlen(weekdays[i]) && 0 == strncasecmp(s,weekdays[i],len)) return i;
+	}
+	return -1;
+}
+
+// bits first through last, wrapping around at width
+static uint32_t range(int first, int last, int width) {
+	uint32_t bits = 0;
+	for(;;) {
+		bits |= 1U << first;
+		if(first == last) return bits;
+		if(++first == width) first = 0;
+	}
+}
+
+bool schedule_days(struct schedule* sched, const char* s, size_t len) {
+	size_t start, end = 0;
+	sched->days = 0;
+	while(word(s,len,&start,&end)) {
+		const char* w = s+start;
+		size_t wlen = end-start;
+		if(wlen == 8 && 0 == strncasecmp(w,"weekdays",8)) {
+			sched->days |= range(1,5,7);
+			continue;
+		}
+		if(wlen == 8 && 0 == strncasecmp(w,"weekends",8)) {
+			sched->days |= range(6,0,7);
+			continue;
+		}
+		const char* dash = memchr(w,'-',wlen);
+		int first = weekday(w, dash ? dash-w : wlen);
+		int last = dash ? weekday(dash+1,w+wlen-dash-1) : first;
+		if(first < 0 || last < 0) {
+			warn("days = %.*s: %.*s isn't a day of the week",(int)len,s,(int)wlen,w);
+			sched->days = 0;
+			return false;
+		}
+		// fri-mon wraps around the weekend
+		sched->days |= range(first,last,7);
+	}
+	return true;
+}
+
+bool schedule_dates(struct schedule* sched, const char* s, size_t len) {
+	size_t start, end = 0;
+	sched->dates = 0;
+	while(word(s,len,&start,&end)) {
+		const char* w = s+start;
+		size_t wlen = end-start;
+		const char* dash = memchr(w,'-',wlen);
+		int first, last;
+		bool ok = number(w, dash ? dash-w : wlen, &first);
+		if(dash) {
+			ok = ok && number(dash+1,w+wlen-dash-1,&last) && first <= last;
+		} else {
+			last = first;
+		}
+		if(!ok || first < 1 || last > 31) {
+			warn("dates = %.*s: %.*s isn't a day of the month",(int)len,s,(int)wlen,w);
+			sched->dates = 0;
+			return false;
+		}
+		sched->dates |= range(first,last,32);
+	}
+	return true;
+}
+
+/* only a few zones, so each one's name is kept just once and compared by
+	 pointer. Switching TZ means tzset rereading the zone's file, so rather than
+	 switch for every rule every time, each zone remembers its offset from UTC
+	 and the stretch of time that offset holds for, and only switches to look
+	 again once a rule's base is outside that. */
+struct zone {
+	char* name;
+	long gmtoff;
+	// the offset holds for from <= t < until
+	time_t from, until;
+};
+static struct zone** zones = NULL;
+static size_t nzones = 0;
+
+bool schedule_tz(struct schedule* sched, const char* s, size_t len) {
+	size_t i;
+	for(i=0;i<nzones;++i) {
+		if(strlen(zones[i]->name) == len && 0 == memcmp(zones[i]->name,s,len)) {
+			sched->tz = zones[i]->name;
+			return true;
+		}
+	}
+	char* name = strndup(s,len);
+	// a POSIX TZ like EST5EDT has digits, otherwise it's a file
+	bool posix = false;
+	for(i=0;i<len;++i) {
+		if(isdigit(name[i])) posix = true;
+	}
+	if(!posix) {
+		char* path = NULL;
+		asprintf(&path,"/usr/share/zoneinfo/%s",name);
+		bool found = 0 == access(path,R_OK);
+		free(path);
+		if(!found) {
+			warn("no timezone called %s",name);
+			free(name);
+			return false;
+		}
+	}
+	struct zone* zone = calloc(1,sizeof(*zone));
+	zone->name = name;
+	zones = realloc(zones,(nzones+1)*sizeof(*zones));
+	zones[nzones++] = zone;
+	sched->tz = name;
+	return true;
+}
+
+static bool zone_saved = false;
+static char* local_zone = NULL;
+
+static void use_zone(const char* tz) {
+	if(!zone_saved) {
+		const char* mine = getenv("TZ");
+		if(mine) local_zone = strdup(mine);
+		zone_saved = true;
+	}
+	if(tz) {
+		setenv("TZ",tz,1);
+	} else if(local_zone) {
+		setenv("TZ",local_zone,1);
+	} else {
+		unsetenv("TZ");
+	}
+	tzset();
+}
+
+static long offset_at(time_t t) {
+	struct tm date;
+	localtime_r(&t,&date);
+	return date.tm_gmtoff;
+}
+
+/* how far from t (a day at a time in the direction of step, then halving down
+	 to the second) the offset is still off. A year and a bit is far enough. */
+static time_t edge(time_t t, long off, time_t step) {
+	int i;
+	for(i=0;i<400;++i) {
+		if(offset_at(t+step) != off) break;
+		t += step;
+	}
+	if(i == 400) return t;
+	// off at same, not at other
+	time_t same = t, other = t+step;
+	while(same - other > 1 || other - same > 1) {
+		time_t middle = same + (other - same) / 2;
+		if(offset_at(middle) == off) {
+			same = middle;
+		} else {
+			other = middle;
+		}
+	}
+	return step > 0 ? other : same;
+}
+
+static const struct zone* zone_at(const char* tz, time_t base) {
+	size_t i;
+	struct zone* zone = NULL;
+	for(i=0;i<nzones;++i) {
+		if(zones[i]->name == tz) zone = zones[i];
+	}
+	assert(zone != NULL);
+	if(zone->until == 0 || base < zone->from || base >= zone->until) {
+		use_zone(tz);
+		zone->gmtoff = offset_at(base);
+		zone->from = edge(base,zone->gmtoff,-86400);
+		zone->until = edge(base,zone->gmtoff,86400);
+		use_zone(NULL);
+	}
+	return zone;
+}
+
+static bool leap(int year) {
+	year += 1900;
+	return year % 4 == 0 && (year % 100 != 0 || year % 400 == 0);
+}
+
+static int month_days(int year, int mon) {
+	static const int days[] = { 31, 28, 31, 30, 31, 30, 31, 31, 30, 31, 30, 31 };
+	return days[mon] + (mon == 1 && leap(year));
+}
+
+// sunday is 0
+static int weekday_of(int year, int mon, int mday) {
+	static const int offsets[] = { 0, 3, 2, 5, 0, 3, 5, 1, 4, 6, 2, 4 };
+	int y = year + 1900 - (mon < 2);
+	return (y + y/4 - y/100 + y/400 + offsets[mon] + mday) % 7;
+}
+
+/* bit d set for each day d of the month that's in days and dates. Shifting the
+	 week's bits to line up with the 1st, then repeating them, gives every day of
+	 the week at once. */
+static uint64_t matching(const struct schedule* sched, int year, int mon) {
+	uint64_t days = sched->days ? sched->days : 0x7f;
+	int first = weekday_of(year,mon,1);
+	uint64_t week = ((days >> first) | (days << (7-first))) & 0x7f;
+	uint64_t month = week | week << 7 | week << 14 | week << 21 | week << 28;
+	month <<= 1; // the 1st is bit 1
+	uint64_t dates = sched->dates ? sched->dates : ~UINT64_C(0);
+	uint64_t exists = ((UINT64_C(1) << month_days(year,mon)) - 1) << 1;
+	return month & dates & exists;
+}
+
+// with a zone, the time in it is just an offset away from UTC
+static void local_day(time_t t, const struct zone* zone, struct tm* day) {
+	if(zone) {
+		t += zone->gmtoff;
+		gmtime_r(&t,day);
+	} else {
+		localtime_r(&t,day);
+	}
+}
+
+static time_t fire(const struct tm* day, int32_t at, const struct zone* zone) {
+	struct tm t = {
+		.tm_year = day->tm_year,
+		.tm_mon = day->tm_mon,
+		.tm_mday = day->tm_mday,
+		.tm_hour = at / 3600,
+		.tm_min = at / 60 % 60,
+		.tm_sec = at % 60,
+		.tm_isdst = -1
+	};
+	if(zone) return timegm(&t) - zone->gmtoff;
+	return mktime(&t);
+}
+
+static bool next_from(const struct schedule* sched, time_t base, time_t* next,
+											const struct zone* zone) {
+	static const int32_t midnight = 0;
+	const int32_t* at = sched->nat ? sched->at : &midnight;
+	size_t nat = sched->nat ? sched->nat : 1;
+	struct tm day;
+	local_day(base,zone,&day);
+	// today counts, if one of its times is still to come
+	int from = day.tm_mday;
+	/* by the clock on the wall, not just by the second, so the hour DST repeats
+		 doesn't run the rule twice */
+	int today = day.tm_mday;
+	int32_t now = day.tm_hour*3600 + day.tm_min*60 + day.tm_sec;
+	int months;
+	for(months=0;months<MONTHS_MAX;++months) {
+		uint64_t days = matching(sched,day.tm_year,day.tm_mon);
+		days &= ~((UINT64_C(1) << from) - 1);
+		while(days) {
+			day.tm_mday = __builtin_ctzll(days);
+			days &= days - 1;
+			size_t i;
+			for(i=0;i<nat;++i) {
+				if(months == 0 && day.tm_mday == today && at[i] <= now) continue;
+				*next = fire(&day,at[i],zone);
+				if(*next > base) return true;
+			}
+		}
+		from = 1;
+		if(++day.tm_mon == 12) {
+			day.tm_mon = 0;
+			++day.tm_year;
+		}
+	}
+	return false;
+}
+
+bool schedule_next(const struct schedule* sched, time_t base, time_t* next) {
+	if(sched->tz == NULL) return next_from(sched,base,next,NULL);
+	const struct zone* zone = zone_at(sched->tz,base);
+	bool found = next_from(sched,base,next,zone);
+	if(found && *next < zone->until) return true;
+	// past where the offset changes, so do it the slow way
+	use_zone(sched->tz);
+	found = next_from(sched,base,next,NULL);
+	use_zone(NULL);
+	return found;
+}
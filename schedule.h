@@ -0,0 +1,48 @@
+#ifndef SCHEDULE_H
+#define SCHEDULE_H
+
+#include <stdbool.h>
+#include <stdint.h>
+#include <sys/types.h> // size_t
+#include <time.h>
+
+/* rules pinned to the calendar instead of running an interval after they last
+	 ran. at = 03:15 15:45 picks times of day, days = mon-fri days of the week,
+	 dates = 1,15 days of the month, and tz = Europe/Berlin the zone they're all
+	 in. A day has to satisfy both days and dates, so days = mon with
+	 dates = 1-7 is the first monday of the month.
+
+	 The next time is worked out from bit masks of the matching days a month at
+	 a time, never by trying each minute like cron.
+
+	 Unlike every other setting, at, days and dates only apply to the one rule
+	 they come before, since a time is rarely right for two rules at once. tz
+	 carries on like the rest. Such rules run at their times whether or not the
+	 last run failed, so retries and failing don't apply to them. */
+
+#define SCHEDULE_TIMES 8
+
+struct schedule {
+	// seconds after midnight, sorted. Just midnight if only days or dates are set
+	int32_t at[SCHEDULE_TIMES];
+	uint8_t nat;
+	// bit 0 is sunday, none means any day
+	uint8_t days;
+	// bit 1 is the 1st, none means any date
+	uint32_t dates;
+	// the same pointer for the same zone, NULL for local time
+	const char* tz;
+};
+
+#define scheduled(s) ((s)->nat || (s)->days || (s)->dates)
+
+// these all warn and return false when s doesn't make sense
+bool schedule_at(struct schedule* sched, const char* s, size_t len);
+bool schedule_days(struct schedule* sched, const char* s, size_t len);
+bool schedule_dates(struct schedule* sched, const char* s, size_t len);
+bool schedule_tz(struct schedule* sched, const char* s, size_t len);
+
+// the first time after base it fires, false if it never does (dates = 30 and days = feb...)
+bool schedule_next(const struct schedule* sched, time_t base, time_t* next);
+
+#endif /* SCHEDULE_H */
@@ -0,0 +1,148 @@
+#define _GNU_SOURCE
+#include "simulate.h"
+#include "parse.h" // parse_interval
+#include "errors.h"
+#include <sys/wait.h> // W_EXITCODE
+#include <stdio.h>
+#include <stdint.h>
+#include <string.h> // strlen
+
+bool simulating = false;
+
+struct simulated simulate_defaults = {
+	.duration = { .tm_sec = 1 },
+	.failure = 0
+};
+
+static struct timespec virtual_clock, start, end;
+// start of the minute the simulation starts in
+static time_t base;
+static uint64_t seed = 1;
+
+struct minute {
+	uint32_t starts;
+	uint32_t failures;
+	// most rules that were due at once during this minute
+	uint32_t backlog;
+	// most commands running at once
+	uint32_t running;
+};
+
+static struct minute* minutes = NULL;
+static size_t nminutes = 0;
+
+void simulate_init(const struct tm* duration) {
+	const char* s = getenv("sim_start");
+	if(s) {
+		virtual_clock.tv_sec = strtol(s,NULL,0);
+		virtual_clock.tv_nsec = 0;
+	} else {
+		clock_gettime(CLOCK_REALTIME,&virtual_clock);
+	}
+	s = getenv("sim_seed");
+	if(s) {
+		seed = strtoull(s,NULL,0);
+		if(seed == 0) seed = 1; // xorshift sticks at 0
+	}
+	s = getenv("sim_duration");
+	if(s) {
+		parse_interval(&simulate_defaults.duration,s,strlen(s));
+	}
+	s = getenv("sim_failure");
+	if(s) {
+		simulate_defaults.failure = strtof(s,NULL);
+	}
+	start = virtual_clock;
+	end.tv_sec = interval_secs_from(&start,duration);
+	end.tv_nsec = start.tv_nsec;
+	base = start.tv_sec - start.tv_sec % 60;
+	nminutes = (end.tv_sec - base) / 60 + 1;
+	minutes = calloc(nminutes,sizeof(*minutes));
+	if(!getenv("loglevel")) {
+		// every pretend run would otherwise log "running command"
+		log_level = LOG_ERROR;
+	}
+	virtual_now = &virtual_clock;
+	simulating = true;
+}
+
+bool simulate_done(void) {
+	return !timespecbefore(&virtual_clock,&end);
+}
+
+static float random_fraction(void) {
+	// xorshift64, so the same seed gives the same simulation
+	seed ^= seed << 13;
+	seed ^= seed >> 7;
+	seed ^= seed << 17;
+	return (seed >> 11) * (1.0 / (UINT64_C(1) << 53));
+}
+
+static struct minute* current_minute(void) {
+	size_t which = (virtual_clock.tv_sec - base) / 60;
+	if(which >= nminutes) return NULL;
+	return minutes + which;
+}
+
+int simulate_start(const struct simulated* how, size_t running, size_t backlog,
+									 struct timespec* done) {
+	bool failed = random_fraction() < how->failure;
+	struct minute* m = current_minute();
+	if(m) {
+		++m->starts;
+		if(failed) ++m->failures;
+		if(backlog > m->backlog) m->backlog = backlog;
+		if(running+1 > m->running) m->running = running+1;
+	}
+	done->tv_sec = interval_secs_from(&virtual_clock,&how->duration);
+	done->tv_nsec = virtual_clock.tv_nsec;
+	return W_EXITCODE(failed ? 1 : 0, 0);
+}
+
+void simulate_sleep(const struct timespec* left) {
+	timespecadd(&virtual_clock,&virtual_clock,left);
+}
+
+void simulate_report(void) {
+	size_t i;
+	size_t total = 0, failures = 0;
+	size_t peak = 0, peak_backlog = 0, peak_running = 0;
+	time_t peak_at = start.tv_sec, peak_backlog_at = start.tv_sec,
+		peak_running_at = start.tv_sec;
+	puts("minute            starts failed backlog running");
+	for(i=0;i<nminutes;++i) {
+		struct minute* m = minutes + i;
+		if(m->starts == 0) continue;
+		time_t when = base + i * 60;
+		struct tm date;
+		char buf[0x20];
+		localtime_r(&when,&date);
+		strftime(buf,sizeof(buf),"%Y-%m-%d %H:%M",&date);
+		printf("%s %6u %6u %7u %7u ",
+					 buf,m->starts,m->failures,m->backlog,m->running);
+		uint32_t bar;
+		for(bar=0;bar<m->starts && bar<60;++bar) {
+			putchar('#');
+		}
+		putchar('\n');
+		total += m->starts;
+		failures += m->failures;
+		if(m->starts > peak) {
+			peak = m->starts;
+			peak_at = when;
+		}
+		if(m->backlog > peak_backlog) {
+			peak_backlog = m->backlog;
+			peak_backlog_at = when;
+		}
+		if(m->running > peak_running) {
+			peak_running = m->running;
+			peak_running_at = when;
+		}
+	}
+	printf("%zu runs (%zu failed) over %ld seconds\n",
+				 total, failures, end.tv_sec - start.tv_sec);
+	printf("peak starts per minute: %zu at %s\n",peak,myctime(peak_at));
+	printf("peak backlog: %zu at %s\n",peak_backlog,myctime(peak_backlog_at));
+	printf("peak concurrency: %zu at %s\n",peak_running,myctime(peak_running_at));
+}
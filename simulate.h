@@ -0,0 +1,34 @@
+#ifndef SIMULATE_H
+#define SIMULATE_H
+
+#include "calendar.h"
+#include <stdbool.h>
+
+/* --simulate runs the scheduler against virtual_now instead of the real clock,
+	 and instead of running commands, pretends they took sim_duration and failed
+	 with probability sim_failure. Both can be set per rule, or defaulted from the
+	 environment variables of the same name. sim_seed and sim_start (seconds since
+	 the epoch) make runs repeatable.
+*/
+
+extern bool simulating;
+
+struct simulated {
+	struct tm duration;
+	float failure;
+};
+
+extern struct simulated simulate_defaults;
+
+void simulate_init(const struct tm* duration);
+// true when the virtual clock has run past the end of the simulation
+bool simulate_done(void);
+/* pretend to start a command while running others are, setting when it
+	 finishes and returning the wait status it'll finish with. */
+int simulate_start(const struct simulated* how, size_t running, size_t backlog,
+									 struct timespec* done);
+// nothing to do, so skip ahead
+void simulate_sleep(const struct timespec* left);
+void simulate_report(void);
+
+#endif /* SIMULATE_H */
@@ -0,0 +1,194 @@
+#define _GNU_SOURCE
+#include "sources.h"
+#include "queue.h"
+#include "errors.h"
+#include "jobs.h" // job_forget
+#include <string.h> // strdup, strrchr
+#include <fcntl.h> // openat
+#include <sys/stat.h> // mkdirat
+#include <dirent.h>
+#include <unistd.h> // close
+#include <stdio.h> // asprintf
+
+#define WATCH_FLAGS (IN_MOVED_TO|IN_CLOSE_WRITE|IN_MOVED_FROM|IN_DELETE)
+
+struct ruleset** sets = NULL;
+size_t nsets = 0;
+
+// directories where any new file is a new rules file
+struct directory {
+	int watch;
+	char* path;
+};
+static struct directory* directories = NULL;
+static size_t ndirectories = 0;
+
+static int dues = -1;
+
+static const char* basename_of(const char* path) {
+	const char* slash = strrchr(path,'/');
+	if(slash) return slash+1;
+	return path;
+}
+
+static int watch_dir_of(int inotify, const char* path) {
+	const char* slash = strrchr(path,'/');
+	if(slash == NULL) {
+		return inotify_add_watch(inotify,".",WATCH_FLAGS);
+	}
+	char* dir = strndup(path,slash-path);
+	int wd = inotify_add_watch(inotify,*dir ? dir : "/",WATCH_FLAGS);
+	free(dir);
+	return wd;
+}
+
+static void enqueue(struct ruleset* set) {
+	size_t i;
+	for(i=0;i<set->num;++i) {
+		queue_push(set->rules + i);
+	}
+}
+
+static void dequeue(struct ruleset* set) {
+	size_t i;
+	for(i=0;i<set->num;++i) {
+		struct rule* r = set->rules + i;
+		if(r->running) {
+			// let it finish, and give it back to r if r is still there after
+			job_forget(r);
+		}
+		queue_remove(r);
+	}
+}
+
+static void add_set(int inotify, const char* path, bool main) {
+	struct ruleset* set = calloc(1,sizeof(*set));
+	set->path = strdup(path);
+	if(main) {
+		set->namespace = strdup("");
+		set->dues = fcntl(dues,F_DUPFD_CLOEXEC,0);
+	} else {
+		// dues/some%dir%rules so names only have to be unique per file
+		set->namespace = strdup(path);
+		char* c;
+		for(c=set->namespace;*c;++c) {
+			if(*c == '/') *c = '%';
+		}
+		mkdirat(dues,set->namespace,0755);
+		set->dues = openat(dues,set->namespace,O_RDONLY|O_DIRECTORY|O_CLOEXEC);
+	}
+	assert(set->dues >= 0);
+	set->watch = watch_dir_of(inotify,path);
+	ruleset_parse(set);
+	enqueue(set);
+
+	if(nsets%0x10 == 0) {
+		sets = realloc(sets,(nsets+0x10)*sizeof(*sets));
+	}
+	sets[nsets++] = set;
+}
+
+static void remove_set(size_t which) {
+	struct ruleset* set = sets[which];
+	info("forgetting %s",set->path);
+	dequeue(set);
+	ruleset_clear(set);
+	// nothing to find, so whatever was running is on its own
+	jobs_reattach(set);
+	close(set->dues);
+	free(set->namespace);
+	free(set->path);
+	free(set);
+	sets[which] = sets[--nsets];
+}
+
+static bool ignored(const char* name) {
+	// editor droppings
+	return name[0] == '.' || name[strlen(name)-1] == '~';
+}
+
+static void add_directory(int inotify, const char* path) {
+	DIR* d = opendir(path);
+	if(d == NULL) return;
+	if(ndirectories%0x10 == 0) {
+		directories = realloc(directories,
+													(ndirectories+0x10)*sizeof(*directories));
+	}
+	struct directory* dir = directories + ndirectories++;
+	dir->path = strdup(path);
+	dir->watch = inotify_add_watch(inotify,path,WATCH_FLAGS);
+	struct dirent* ent;
+	while((ent = readdir(d))) {
+		if(ignored(ent->d_name)) continue;
+		if(ent->d_type != DT_REG && ent->d_type != DT_LNK && ent->d_type != DT_UNKNOWN)
+			continue;
+		char* sub;
+		assert(0 < asprintf(&sub,"%s/%s",path,ent->d_name));
+		add_set(inotify,sub,false);
+		free(sub);
+	}
+	closedir(d);
+}
+
+void sources_init(int inotify, const char* paths) {
+	mkdir("dues",0755);
+	dues = open("dues",O_RDONLY|O_DIRECTORY|O_CLOEXEC);
+	assert(dues >= 0);
+	if(paths == NULL) {
+		add_set(inotify,"rules",true);
+		add_directory(inotify,"rules.d");
+		return;
+	}
+	bool only = NULL == strchr(paths,':');
+	char* copy = strdup(paths);
+	char* save = NULL;
+	char* path;
+	for(path=strtok_r(copy,":",&save);path;path=strtok_r(NULL,":",&save)) {
+		struct stat info;
+		if(0 == stat(path,&info) && S_ISDIR(info.st_mode)) {
+			add_directory(inotify,path);
+		} else {
+			// a single rules file keeps its dues where they always were
+			add_set(inotify,path,only);
+		}
+	}
+	free(copy);
+}
+
+void sources_changed(int inotify, const struct inotify_event* event) {
+	if(event->len == 0) return;
+	size_t i;
+	for(i=0;i<nsets;++i) {
+		struct ruleset* set = sets[i];
+		if(set->watch != event->wd) continue;
+		if(0 != strcmp(basename_of(set->path),event->name)) continue;
+		if(event->mask & (IN_DELETE|IN_MOVED_FROM)) {
+			size_t d;
+			for(d=0;d<ndirectories;++d) {
+				if(directories[d].watch == event->wd) {
+					// gone from a rules directory, so it's gone for good
+					remove_set(i);
+					return;
+				}
+			}
+		}
+		// only this set is reparsed, the rest keep their place in the queue
+		info("reloading %s",set->path);
+		dequeue(set);
+		ruleset_parse(set);
+		enqueue(set);
+		jobs_reattach(set);
+		return;
+	}
+	if(!(event->mask & (IN_MOVED_TO|IN_CLOSE_WRITE))) return;
+	if(ignored(event->name)) return;
+	for(i=0;i<ndirectories;++i) {
+		if(directories[i].watch != event->wd) continue;
+		char* path;
+		assert(0 < asprintf(&path,"%s/%s",directories[i].path,event->name));
+		info("new rules file %s",path);
+		add_set(inotify,path,false);
+		free(path);
+		return;
+	}
+}
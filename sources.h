@@ -0,0 +1,20 @@
+#ifndef SOURCES_H
+#define SOURCES_H
+
+#include "rules.h"
+#include <sys/inotify.h>
+
+/* where rules come from. Without the rules environment variable that's
+	 ~/.config/regularly/rules plus every file in ~/.config/regularly/rules.d/,
+	 otherwise rules is a colon separated list of rules files and directories of
+	 them. Either way, one daemon schedules all of them from the one queue.
+*/
+
+extern struct ruleset** sets;
+extern size_t nsets;
+
+void sources_init(int inotify, const char* paths);
+// a watched directory changed, so reload whichever set that was
+void sources_changed(int inotify, const struct inotify_event* event);
+
+#endif /* SOURCES_H */
@@ -0,0 +1,224 @@
+#define _GNU_SOURCE
+#include "template.h"
+#include "errors.h"
+#include <string.h>
+#include <stdlib.h>
+#include <stdio.h> // snprintf
+#include <ctype.h> // isdigit
+
+// more than this is probably a typo in a range
+#define INSTANCES_MAX (1<<20)
+
+static bool range(const char* s, size_t len, long* first, long* last) {
+	const char* dots = memmem(s,len,"..",2);
+	if(dots == NULL || dots == s || dots+2 == s+len) return false;
+	// so it's a range, even if it's too long to count
+	const char* c;
+	for(c=s;c<s+len;++c) {
+		if(c == dots || c == dots+1) continue;
+		if(!isdigit(*c)) return false;
+	}
+	*first = strtol(s,NULL,10);
+	*last = strtol(dots+2,NULL,10);
+	return true;
+}
+
+bool template_var(struct template* t, const char* name, size_t nlen,
+									const char* value, size_t vlen) {
+	struct variable var = {
+		.name = strndup(name,nlen)
+	};
+	long first, last;
+	size_t most = INSTANCES_MAX / (t->count ? t->count : 1);
+	if(range(value,vlen,&first,&last)) {
+		var.range = true;
+		var.first = first;
+		// both are digits, so neither is negative and this doesn't overflow
+		if(last < first) {
+			var.count = 0;
+		} else if((unsigned long)(last - first) >= most) {
+			var.count = most + 1;
+		} else {
+			var.count = last - first + 1;
+		}
+	} else {
+		// one block for the values, split in place
+		char* copy = strndup(value,vlen);
+		char* save = NULL;
+		char* v;
+		for(v=strtok_r(copy," \t,",&save);v;v=strtok_r(NULL," \t,",&save)) {
+			var.values = realloc(var.values,(var.count+1)*sizeof(*var.values));
+			var.values[var.count++] = v;
+		}
+		if(var.count == 0) free(copy);
+	}
+	if(var.count == 0 || var.count > most) {
+		warn("foreach %s = %.*s is %s",var.name,(int)vlen,value,
+				 var.count ? "too many" : "nothing");
+		free(var.name);
+		if(var.values) free(var.values[0]);
+		free(var.values);
+		return false;
+	}
+	t->vars = realloc(t->vars,(t->nvars+1)*sizeof(*t->vars));
+	t->vars[t->nvars++] = var;
+	t->count = (t->count ? t->count : 1) * var.count;
+	return true;
+}
+
+static int lookup(const struct template* t, const char* name, size_t len) {
+	size_t i;
+	for(i=0;i<t->nvars;++i) {
+		if(strlen(t->vars[i].name) == len && 0 == memcmp(t->vars[i].name,name,len))
+			return i;
+	}
+	return -1;
+}
+
+// split text[start..end) into fragments at each {variable} it has
+static size_t cut(const struct template* t, const char* text,
+									size_t start, size_t end, struct fragment** out) {
+	size_t n = 0, literal = start, i;
+	*out = NULL;
+	for(i=start;i<end;++i) {
+		if(text[i] != '{') continue;
+		const char* close = memchr(text+i,'}',end-i);
+		if(close == NULL) break;
+		int var = lookup(t,text+i+1,close-text-i-1);
+		// {anything else} is left for the shell
+		if(var < 0) continue;
+		*out = realloc(*out,(n+1)*sizeof(**out));
+		(*out)[n].offset = literal;
+		(*out)[n].length = i - literal;
+		(*out)[n].var = var;
+		++n;
+		i = close - text;
+		literal = i+1;
+	}
+	*out = realloc(*out,(n+1)*sizeof(**out));
+	(*out)[n].offset = literal;
+	(*out)[n].length = end - literal;
+	(*out)[n].var = -1;
+	return n+1;
+}
+
+static size_t value(const struct template* t, size_t var, size_t instance,
+										char* buf, size_t space) {
+	size_t i, stride = 1;
+	// the first variable changes slowest
+	for(i=var+1;i<t->nvars;++i) stride *= t->vars[i].count;
+	const struct variable* v = t->vars + var;
+	size_t which = instance / stride % v->count;
+	if(v->range) {
+		return snprintf(buf,space,"%ld",v->first + (long)which);
+	}
+	return snprintf(buf,space,"%s",v->values[which]);
+}
+
+static size_t expand(const struct template* t, const char* text,
+										 const struct fragment* f, size_t n,
+										 size_t instance, char* buf, size_t space) {
+	size_t len = 0, i;
+	for(i=0;i<n;++i) {
+		if(len + f[i].length < space) {
+			memcpy(buf+len,text+f[i].offset,f[i].length);
+		}
+		len += f[i].length;
+		if(f[i].var >= 0) {
+			len += value(t,f[i].var,instance,
+									 len < space ? buf+len : NULL,len < space ? space-len : 0);
+		}
+	}
+	if(len < space) buf[len] = '\0';
+	return len;
+}
+
+void template_finish(struct template* t, const char* command, size_t clen,
+										 const char* name, char** names) {
+	size_t nlen = name ? strlen(name) : 0;
+	size_t i;
+	// a name without variables gets all of them tacked on, so it's unique
+	bool plain = name && NULL == strchr(name,'{');
+	size_t extra = 0;
+	if(plain) {
+		for(i=0;i<t->nvars;++i) extra += strlen(t->vars[i].name) + 3;
+	}
+	t->text = malloc(clen + nlen + extra + 1);
+	memcpy(t->text,command,clen);
+	if(name) {
+		memcpy(t->text+clen,name,nlen);
+		if(plain) {
+			char* c = t->text+clen+nlen;
+			for(i=0;i<t->nvars;++i) {
+				c += sprintf(c,"-{%s}",t->vars[i].name);
+			}
+			nlen += extra;
+		}
+	}
+	t->text[clen+nlen] = '\0';
+	t->ncommand = cut(t,t->text,0,clen,&t->command);
+	struct pattern* patterns[] = {&t->after, &t->after_success, &t->inputs};
+	for(i=0;i<sizeof(patterns)/sizeof(*patterns);++i) {
+		struct pattern* p = patterns[i];
+		if(p->text) p->npieces = cut(t,p->text,0,strlen(p->text),&p->pieces);
+	}
+	if(name == NULL) return;
+
+	struct fragment* pieces;
+	size_t npieces = cut(t,t->text,clen,clen+nlen,&pieces);
+	size_t total = 0;
+	for(i=0;i<t->count;++i) {
+		total += expand(t,t->text,pieces,npieces,i,NULL,0) + 1;
+	}
+	t->names = malloc(total);
+	char* at = t->names;
+	for(i=0;i<t->count;++i) {
+		names[i] = at;
+		at += expand(t,t->text,pieces,npieces,i,at,total - (at - t->names)) + 1;
+	}
+	free(pieces);
+}
+
+const char* template_command(const struct template* t, size_t instance) {
+	static char* buf = NULL;
+	static size_t space = 0;
+	size_t len = expand(t,t->text,t->command,t->ncommand,instance,buf,space);
+	if(len >= space) {
+		space = len + 0x100;
+		buf = realloc(buf,space);
+		expand(t,t->text,t->command,t->ncommand,instance,buf,space);
+	}
+	return buf;
+}
+
+char* template_fill(const struct template* t, const struct pattern* p,
+										size_t instance) {
+	if(p->text == NULL) return NULL;
+	size_t len = expand(t,p->text,p->pieces,p->npieces,instance,NULL,0);
+	char* buf = malloc(len+1);
+	expand(t,p->text,p->pieces,p->npieces,instance,buf,len+1);
+	return buf;
+}
+
+void template_free(struct template* t) {
+	size_t i;
+	for(i=0;i<t->nvars;++i) {
+		free(t->vars[i].name);
+		if(t->vars[i].values) {
+			// they're all in the block the first one starts
+			free(t->vars[i].values[0]);
+			free(t->vars[i].values);
+		}
+	}
+	free(t->vars);
+	free(t->command);
+	free(t->text);
+	free(t->names);
+	free(t->after.text);
+	free(t->after.pieces);
+	free(t->after_success.text);
+	free(t->after_success.pieces);
+	free(t->inputs.text);
+	free(t->inputs.pieces);
+	free(t);
+}
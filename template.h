@@ -0,0 +1,76 @@
+#ifndef TEMPLATE_H
+#define TEMPLATE_H
+
+#include <stdbool.h>
+#include <stdint.h>
+#include <sys/types.h> // size_t
+
+/* one rule written once for many hosts, shards, whatever:
+
+	 foreach host = alpha beta gamma
+	 foreach shard = 0..255
+	 name = sync-{host}-{shard}
+	 rsync -a /data/{shard} {host}:/data/{shard}
+
+	 is 768 rules. Every instance shares the template's one copy of the command,
+	 cut up into the literal fragments between the {variables}, and the command
+	 is only put together when it's about to run. A rule just knows its template
+	 and which instance it is. Names are expanded up front, all into one block,
+	 since they're looked up and used for file names. after =, after_success =
+	 and inputs = can have {variables} too, and are filled in when they're used. */
+
+struct fragment {
+	// literal text, then the variable, unless var is -1
+	uint32_t offset;
+	uint32_t length;
+	int32_t var;
+};
+
+// after =, after_success = or inputs =, cut up like the command
+struct pattern {
+	char* text;
+	struct fragment* pieces;
+	size_t npieces;
+};
+
+struct variable {
+	char* name;
+	// first..first+count-1, or values
+	bool range;
+	long first;
+	size_t count;
+	char** values;
+};
+
+struct template {
+	// the command, and the name if any, that the fragments point into
+	char* text;
+	struct fragment* command;
+	size_t ncommand;
+	struct variable* vars;
+	size_t nvars;
+	// how many instances
+	size_t count;
+	// every instance's name, one after another
+	char* names;
+	// the rules' after =, after_success = and inputs =, text NULL if not given
+	struct pattern after;
+	struct pattern after_success;
+	struct pattern inputs;
+};
+
+// foreach name = value. Warns and returns false if value makes no sense
+bool template_var(struct template* t, const char* name, size_t nlen,
+									const char* value, size_t vlen);
+/* the variables are all in, so cut up the command, and the patterns that have
+	 text. With a name, fill in names[i] with each instance's name. */
+void template_finish(struct template* t, const char* command, size_t clen,
+										 const char* name, char** names);
+// instance's command. Overwritten every call.
+const char* template_command(const struct template* t, size_t instance);
+// instance's copy of a pattern, to free. NULL if it has no text
+char* template_fill(const struct template* t, const struct pattern* p,
+										size_t instance);
+void template_free(struct template* t);
+
+#endif /* TEMPLATE_H */
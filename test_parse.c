@@ -1,9 +1,282 @@
 #include "parse.h"
 #include "calendar.h"
+#include "template.h"
+#include "schedule.h"
+#include <stdlib.h> // setenv
 #include <stdio.h>
+#include <string.h>
+#include <ctype.h> // toupper
+
+static int failures = 0;
+
+#define check(what, ...) if(!(what)) {					\
+		++failures;																	\
+		printf("FAIL: " __VA_ARGS__);								\
+		putchar('\n');															\
+	}
+
+/* every spelling of every unit, in every mix of upper and lower case, with and
+	 without a space after the number, and nothing else of 1-3 letters. */
+static const struct {
+	const char* spelling;
+	int days, hours, minutes, seconds, months, years;
+} units[] = {
+	{ "s", .seconds = 1 }, { "sec", .seconds = 1 }, { "secs", .seconds = 1 },
+	{ "second", .seconds = 1 }, { "seconds", .seconds = 1 },
+	{ "m", .minutes = 1 }, { "min", .minutes = 1 }, { "mins", .minutes = 1 },
+	{ "minute", .minutes = 1 }, { "minutes", .minutes = 1 },
+	{ "h", .hours = 1 }, { "hr", .hours = 1 }, { "hrs", .hours = 1 },
+	{ "hour", .hours = 1 }, { "hours", .hours = 1 },
+	{ "d", .days = 1 }, { "day", .days = 1 }, { "days", .days = 1 },
+	{ "w", .days = 7 }, { "wk", .days = 7 }, { "wks", .days = 7 },
+	{ "week", .days = 7 }, { "weeks", .days = 7 },
+	{ "mo", .months = 1 }, { "mos", .months = 1 }, { "mon", .months = 1 },
+	{ "mons", .months = 1 }, { "month", .months = 1 }, { "months", .months = 1 },
+	{ "y", .years = 1 }, { "yr", .years = 1 }, { "yrs", .years = 1 },
+	{ "year", .years = 1 }, { "years", .years = 1 }
+};
+#define NUNITS (sizeof(units)/sizeof(*units))
+
+static bool same(const struct tm* t, int n, int i) {
+	return t->tm_sec == n * units[i].seconds &&
+		t->tm_min == n * units[i].minutes &&
+		t->tm_hour == n * units[i].hours &&
+		t->tm_mday == n * units[i].days &&
+		t->tm_mon == n * units[i].months &&
+		t->tm_year == n * units[i].years;
+}
+
+static void test_spellings(void) {
+	size_t i;
+	for(i=0;i<NUNITS;++i) {
+		const char* spelling = units[i].spelling;
+		size_t len = strlen(spelling);
+		unsigned long cases;
+		for(cases=0;cases < (1UL<<len);++cases) {
+			char buf[0x40];
+			char* word = buf + sprintf(buf,"%s",cases & 1 ? "3 " : "3");
+			size_t j;
+			for(j=0;j<len;++j) {
+				word[j] = cases & (1UL<<j) ? toupper(spelling[j]) : spelling[j];
+			}
+			word[len] = '\0';
+			struct tm t;
+			bool ok = parse_interval_r(&t,buf,strlen(buf),NULL);
+			check(ok && same(&t,3,i),"%s",buf);
+		}
+	}
+	// every other word up to 3 letters isn't a unit
+	char word[4] = {};
+	int a,b,c;
+	for(a=0;a<26;++a) for(b=-1;b<26;++b) for(c=-1;c<26;++c) {
+		if(b < 0 && c >= 0) continue;
+		word[0] = 'a'+a;
+		word[1] = b < 0 ? '\0' : 'a'+b;
+		word[2] = c < 0 ? '\0' : 'a'+c;
+		bool known = false;
+		for(i=0;i<NUNITS;++i) {
+			if(0 == strcmp(word,units[i].spelling)) known = true;
+		}
+		char buf[0x10];
+		sprintf(buf,"2%s",word);
+		struct tm t;
+		bool ok = parse_interval_r(&t,buf,strlen(buf),NULL);
+		check(ok == known,"%s %s",buf,known ? "rejected" : "accepted");
+	}
+}
+
+static void expect(const char* s, const char* want) {
+	struct tm t;
+	const char* problem = NULL;
+	if(!parse_interval_r(&t,s,strlen(s),&problem)) {
+		check(want == NULL,"%s: %s",s,problem);
+		return;
+	}
+	check(want != NULL,"%s should be an error",s);
+	if(want == NULL) return;
+	const char* got = interval_tostr(&t);
+	check(0 == strcmp(got,want),"%s: %s, not %s",s,got,want);
+}
+
+static void test_amounts(void) {
+	expect("10 minutes, 2 hours, 3y, 4months 42m, 2min",
+				 "54 minutes, 2 hours, 4 months, 3 years");
+	expect("30s","30 seconds");
+	expect("1.5 hours","30 minutes, 1 hour");
+	expect("0.7h","42 minutes");
+	expect(".5d","12 hours");
+	expect("1.5w","12 hours, 10 days");
+	expect("2.5 years","6 months, 2 years");
+	expect("1.5mo","15 days, 1 month");
+	expect("1.25 s","1 second");
+	expect("1h30m","30 minutes, 1 hour");
+	expect("","");
+	expect("30",NULL);
+	expect("hours",NULL);
+	expect("3 fortnights",NULL);
+	expect("1..5h",NULL);
+}
+
+#define VAR(t,name,value) template_var(t,name,strlen(name),value,strlen(value))
+
+static struct template* two_by_three(const char* command, const char* name,
+																		 char** names) {
+	struct template* t = calloc(1,sizeof(*t));
+	VAR(t,"host","alpha beta");
+	VAR(t,"shard","7..9");
+	template_finish(t,command,strlen(command),name,names);
+	return t;
+}
+
+static void test_templates(void) {
+	char* names[6];
+	struct template* t = two_by_three("sync {host} {shard} {nope} ${HOME}",
+																		"sync-{shard}.{host}",names);
+	check(t->count == 6,"2 hosts by 3 shards is %zu",t->count);
+	// the first foreach changes slowest
+	static const char* commands[] = {
+		"sync alpha 7 {nope} ${HOME}", "sync alpha 8 {nope} ${HOME}",
+		"sync alpha 9 {nope} ${HOME}", "sync beta 7 {nope} ${HOME}",
+		"sync beta 8 {nope} ${HOME}", "sync beta 9 {nope} ${HOME}"
+	};
+	static const char* want[] = {
+		"sync-7.alpha", "sync-8.alpha", "sync-9.alpha",
+		"sync-7.beta", "sync-8.beta", "sync-9.beta"
+	};
+	size_t i;
+	for(i=0;i<6;++i) {
+		const char* got = template_command(t,i);
+		check(0 == strcmp(got,commands[i]),"instance %zu: %s, not %s",i,got,commands[i]);
+		check(0 == strcmp(names[i],want[i]),"instance %zu: %s, not %s",i,names[i],want[i]);
+	}
+	template_free(t);
+
+	// a name without any variables gets them all on the end
+	t = two_by_three("{host}{shard}","plain",names);
+	check(0 == strcmp(names[0],"plain-alpha-7"),"plain name: %s",names[0]);
+	check(0 == strcmp(names[5],"plain-beta-9"),"plain name: %s",names[5]);
+	check(0 == strcmp(template_command(t,4),"beta8"),"%s",template_command(t,4));
+	template_free(t);
+
+	// after = and inputs = are filled in per instance too
+	t = calloc(1,sizeof(*t));
+	VAR(t,"host","alpha beta");
+	VAR(t,"shard","7..9");
+	t->after.text = strdup("fetch-{host}, setup");
+	t->inputs.text = strdup("/data/{shard}/*.{c,h}");
+	template_finish(t,"x",1,NULL,NULL);
+	char* got = template_fill(t,&t->after,4);
+	check(0 == strcmp(got,"fetch-beta, setup"),"after: %s",got);
+	free(got);
+	got = template_fill(t,&t->inputs,2);
+	check(0 == strcmp(got,"/data/9/*.{c,h}"),"inputs: %s",got);
+	free(got);
+	check(NULL == template_fill(t,&t->after_success,0),"no after_success");
+	template_free(t);
+
+	// unnamed is fine too
+	t = two_by_three("{host",NULL,NULL);
+	check(0 == strcmp(template_command(t,3),"{host"),"%s",template_command(t,3));
+	template_free(t);
+
+	t = calloc(1,sizeof(*t));
+	check(!VAR(t,"n","5..4"),"a backwards range");
+	check(!VAR(t,"n"," , "),"no values");
+	check(!VAR(t,"n","0..99999999999999999999"),"a range too big to count");
+	check(VAR(t,"n","1..1000"),"a thousand");
+	check(VAR(t,"m","1..1000"),"a million");
+	check(!VAR(t,"o","a b"),"two million");
+	check(t->count == 1000000,"still a million, not %zu",t->count);
+	template_finish(t,"",0,NULL,NULL);
+	template_free(t);
+}
+
+/* fires from base on, each one after the last. Times are seconds since the
+	 epoch, worked out separately, so this doesn't just check mktime against
+	 itself. */
+static void expect_schedule(const char* at, const char* days, const char* dates,
+														const char* tz, time_t base, size_t n, const time_t* want) {
+	struct schedule sched = {};
+	if(at) schedule_at(&sched,at,strlen(at));
+	if(days) schedule_days(&sched,days,strlen(days));
+	if(dates) schedule_dates(&sched,dates,strlen(dates));
+	if(tz) schedule_tz(&sched,tz,strlen(tz));
+	size_t i;
+	for(i=0;i<n;++i) {
+		time_t next;
+		if(!schedule_next(&sched,base,&next)) {
+			check(false,"at %s days %s dates %s: never",at,days,dates);
+			return;
+		}
+		check(next == want[i],"at %s days %s dates %s tz %s: #%zu is %ld, not %ld",
+					at,days,dates,tz,i,(long)next,(long)want[i]);
+		base = next;
+	}
+}
+
+#define SCHEDULE(at,days,dates,tz,base,...) {														\
+		static const time_t want[] = { __VA_ARGS__ };												\
+		expect_schedule(at,days,dates,tz,base,sizeof(want)/sizeof(*want),want); \
+	}
+
+static void test_schedules(void) {
+	// everything else is in UTC, so only tz = changes the zone
+	setenv("TZ","UTC",1);
+	tzset();
+	// 2026-10-19 12:00. The 31st skips november
+	SCHEDULE("03:15",NULL,"31",NULL,1792411200,
+					 1793416500 /* oct 31 */, 1798686900 /* dec 31 */);
+	// the first monday of the month
+	SCHEDULE(NULL,"mon","1-7",NULL,1792411200,
+					 1793577600 /* nov 2 */, 1796601600 /* dec 7 */);
+	// the 29th of february only comes in leap years
+	SCHEDULE("12:00",NULL,"29",NULL,1801267200 /* 2027-01-30 */,
+					 1806321600 /* mar 29 */);
+	SCHEDULE("12:00",NULL,"29",NULL,1832803200 /* 2028-01-30 */,
+					 1835438400 /* feb 29 */);
+	// weekends wrap around from saturday to sunday
+	SCHEDULE("08:00 20:00","weekends",NULL,NULL,1792411200,
+					 1792828800 /* sat 24th 8am */, 1792872000, 1792915200, 1792958400,
+					 1793433600 /* the next saturday */);
+	// 2:30 doesn't happen on 2026-03-08 in New York, so it's the time it would be
+	SCHEDULE("02:30",NULL,NULL,"America/New_York",1772884800,
+					 1772955000, 1773037800);
+	// and 1:30 happens twice on 2026-11-01, but it only runs the first time
+	SCHEDULE("01:30",NULL,NULL,"America/New_York",1793448000,
+					 1793511000, 1793601000);
+	SCHEDULE("03:00",NULL,NULL,"Europe/Berlin",1792843200,
+					 1792893600, 1792980000);
+	// and back in UTC after
+	SCHEDULE("03:00",NULL,NULL,NULL,1792843200,1792897200);
+}
+
+static void benchmark(void) {
+	static const char* samples[] = {
+		"10 minutes, 2 hours, 3y, 4months 42m, 2min",
+		"30s", "1.5 hours", "1 day", "2w 3d 4h", "90 seconds"
+	};
+	const size_t rounds = 1000000;
+	size_t bytes = 0, i;
+	struct timespec start, end;
+	clock_gettime(CLOCK_MONOTONIC,&start);
+	for(i=0;i<rounds;++i) {
+		const char* s = samples[i % (sizeof(samples)/sizeof(*samples))];
+		size_t len = strlen(s);
+		struct tm t;
+		parse_interval_r(&t,s,len,NULL);
+		bytes += len;
+	}
+	clock_gettime(CLOCK_MONOTONIC,&end);
+	struct timespec took;
+	timespecsub(&took,&end,&start);
+	double secs = timespecsecs(took);
+	printf("%zu intervals in %.3fs: %.0f ns each, %.1f MB/s\n",
+				 rounds, secs, secs * 1e9 / rounds, bytes / secs / 1e6);
+}
 
 int main(int argc, char *argv[])
 {
+	calendar_init();
   const char s[] = "10 minutes, 2 hours, 3y, 4months 42m, 2min";
   struct parser ctx = {
 	.s = s,
@@ -14,5 +287,14 @@ int main(int argc, char *argv[])
 	fwrite(ctx.s+ctx.start,ctx.tokenlen,1,stdout);
 	printf("| state: %d interval %s\n",ctx.state, interval_tostr(&ctx.interval));
   }
+	test_spellings();
+	test_amounts();
+	test_templates();
+	test_schedules();
+	if(failures) {
+		printf("%d failed\n",failures);
+		return 1;
+	}
+	benchmark();
   return 0;
 }
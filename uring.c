@@ -0,0 +1,465 @@
+#define _GNU_SOURCE
+#include "uring.h"
+#include "errors.h"
+#include <linux/io_uring.h>
+#include <sys/syscall.h>
+#include <sys/mman.h>
+#include <sys/uio.h> // struct iovec
+#include <fcntl.h> // O_WRONLY, AT_FDCWD
+#include <unistd.h> // syscall
+#include <string.h> // memset
+#include <stdio.h> // snprintf
+#include <stdlib.h> // malloc, getenv
+#include <stdint.h>
+#include <errno.h>
+
+bool uring = false;
+
+#define ENTRIES 0x40
+// files being saved at once
+#define SLOTS 0x20
+
+static int ring = -1;
+
+static struct {
+	unsigned *head, *tail, *mask, *array;
+	struct io_uring_sqe* sqes;
+	unsigned entries;
+	// prepared but not yet submitted
+	unsigned pending;
+} sq;
+
+static struct {
+	unsigned *head, *tail, *mask;
+	struct io_uring_cqe* cqes;
+} cq;
+
+/* user_data points at one of these, so completions know what they were for */
+enum kind { POLL, TIMEOUT, CANCEL, LOG, SAVE, PROBE };
+
+struct op {
+	enum kind kind;
+};
+
+// one per arming, so a late completion for a poll we gave up on is harmless
+struct poll_op {
+	struct op op;
+	size_t slot;
+};
+
+static struct {
+	// NULL until armed, and again once it fires
+	struct poll_op* armed;
+	int fd;
+	short events;
+	short revents;
+} polls[4];
+
+// the timeout for the current wait. Older ones get cancelled.
+static struct op* timeout = NULL;
+static bool timed_out = false;
+static struct op cancel_op = { CANCEL };
+
+static struct {
+	struct op op;
+	struct iovec io[2];
+	bool busy;
+} log_op = { { LOG } };
+
+struct save {
+	struct op op;
+	int slot;
+	// four linked operations, free this when they're all done
+	int left;
+	// a due time, or something kept next to one
+	char data[0x20];
+	size_t len;
+	char temp[0x100];
+	char name[0x100];
+};
+
+static int free_slots[SLOTS];
+static int nfree = 0;
+// opening straight into a slot needs 5.15, otherwise saves are synchronous
+static bool direct = false;
+
+/* a failed save, told about next time we're not in the middle of writing the
+	 log, since complaining from in here can end up right back in here */
+static struct {
+	int failed;
+	int error;
+	char name[0x100];
+} unsaved;
+
+static struct op probe_op = { PROBE };
+static int probed;
+
+static int enter(unsigned submit, unsigned wait, const sigset_t* sigmask) {
+	return syscall(__NR_io_uring_enter, ring, submit, wait,
+								 wait ? IORING_ENTER_GETEVENTS : 0,
+								 sigmask, _NSIG/8);
+}
+
+static void submit(void) {
+	while(sq.pending) {
+		int res = enter(sq.pending,0,NULL);
+		if(res < 0) {
+			if(errno == EINTR || errno == EAGAIN || errno == EBUSY) continue;
+			error("io_uring_enter failed");
+		}
+		sq.pending -= res;
+	}
+}
+
+static struct io_uring_sqe* get_sqe(struct op* op) {
+	unsigned tail = *sq.tail;
+	if(tail - __atomic_load_n(sq.head,__ATOMIC_ACQUIRE) == sq.entries) {
+		submit();
+	}
+	unsigned index = tail & *sq.mask;
+	struct io_uring_sqe* sqe = sq.sqes + index;
+	memset(sqe,0,sizeof(*sqe));
+	sqe->user_data = (uintptr_t)op;
+	sq.array[index] = index;
+	__atomic_store_n(sq.tail,tail+1,__ATOMIC_RELEASE);
+	++sq.pending;
+	return sqe;
+}
+
+static void complete(struct io_uring_cqe* cqe) {
+	struct op* op = (struct op*)(uintptr_t)cqe->user_data;
+	switch(op->kind) {
+	case POLL:
+		{
+			struct poll_op* poll = (struct poll_op*)op;
+			if(polls[poll->slot].armed == poll) {
+				polls[poll->slot].armed = NULL;
+				if(cqe->res >= 0) {
+					polls[poll->slot].revents = cqe->res;
+				}
+			}
+			free(poll);
+		}
+		return;
+	case TIMEOUT:
+		if(op == timeout) {
+			timeout = NULL;
+			if(cqe->res == -ETIME) timed_out = true;
+		}
+		free(op);
+		return;
+	case CANCEL:
+		return;
+	case PROBE:
+		probed = cqe->res;
+		return;
+	case LOG:
+		log_op.busy = false;
+		log_written(cqe->res);
+		return;
+	case SAVE:
+		{
+			struct save* save = (struct save*)op;
+			if(cqe->res < 0 && cqe->res != -ECANCELED) {
+				if(unsaved.failed++ == 0) {
+					unsaved.error = -cqe->res;
+					memcpy(unsaved.name,save->name,sizeof(unsaved.name));
+				}
+			}
+			if(--save->left == 0) {
+				free_slots[nfree++] = save->slot;
+				free(save);
+			}
+		}
+		return;
+	};
+}
+
+static void reap(void) {
+	for(;;) {
+		unsigned head = *cq.head;
+		if(head == __atomic_load_n(cq.tail,__ATOMIC_ACQUIRE)) return;
+		struct io_uring_cqe cqe = cq.cqes[head & *cq.mask];
+		// consume it first, in case complete() ends up back in here
+		__atomic_store_n(cq.head,head+1,__ATOMIC_RELEASE);
+		complete(&cqe);
+	}
+}
+
+static void wait_one(void) {
+	int res = enter(sq.pending,1,NULL);
+	if(res < 0) {
+		if(errno != EINTR) error("io_uring_enter failed");
+	} else {
+		sq.pending -= res;
+	}
+	reap();
+}
+
+static void wait_log(void) {
+	while(log_op.busy) {
+		wait_one();
+	}
+}
+
+static bool supported(void) {
+	size_t size = sizeof(struct io_uring_probe) +
+		IORING_OP_LAST * sizeof(struct io_uring_probe_op);
+	struct io_uring_probe* probe = calloc(1,size);
+	bool ok = 0 <= syscall(__NR_io_uring_register, ring,
+												 IORING_REGISTER_PROBE, probe, IORING_OP_LAST);
+	static const int needed[] = {
+		IORING_OP_POLL_ADD, IORING_OP_POLL_REMOVE, IORING_OP_TIMEOUT, IORING_OP_TIMEOUT_REMOVE,
+		IORING_OP_WRITEV,
+		IORING_OP_OPENAT, IORING_OP_WRITE, IORING_OP_CLOSE, IORING_OP_RENAMEAT
+	};
+	size_t i;
+	for(i=0;ok && i<sizeof(needed)/sizeof(*needed);++i) {
+		ok = needed[i] <= probe->last_op &&
+			(probe->ops[needed[i]].flags & IO_URING_OP_SUPPORTED);
+	}
+	free(probe);
+	return ok;
+}
+
+/* older kernels take file_index as padding and hand back a plain descriptor,
+	 which the linked write would then miss. So try it on /dev/null. */
+static bool opens_direct(void) {
+	// a plain open would land on 0 if it's free, so tell that apart
+	bool had0 = fcntl(0,F_GETFD) >= 0;
+	probed = -1;
+	struct io_uring_sqe* sqe = get_sqe(&probe_op);
+	sqe->opcode = IORING_OP_OPENAT;
+	sqe->fd = AT_FDCWD;
+	sqe->addr = (uintptr_t)"/dev/null";
+	sqe->open_flags = O_RDONLY|O_CLOEXEC;
+	sqe->file_index = 1;
+	wait_one();
+	if(probed < 0) return false;
+	if(probed > 0 || (!had0 && fcntl(0,F_GETFD) >= 0)) {
+		close(probed);
+		return false;
+	}
+	sqe = get_sqe(&probe_op);
+	sqe->opcode = IORING_OP_CLOSE;
+	sqe->file_index = 1;
+	wait_one();
+	return probed == 0;
+}
+
+void uring_init(void) {
+	const char* want = getenv("uring");
+	if(want && 0==strcmp(want,"0")) return;
+	struct io_uring_params p = {};
+	ring = syscall(__NR_io_uring_setup, ENTRIES, &p);
+	if(ring < 0) {
+		info("no io_uring, using ppoll");
+		return;
+	}
+	const char* why = NULL;
+	if(!(p.features & IORING_FEAT_SINGLE_MMAP)) {
+		why = "too old";
+		goto FAIL;
+	}
+	size_t sqsize = p.sq_off.array + p.sq_entries * sizeof(unsigned);
+	size_t cqsize = p.cq_off.cqes + p.cq_entries * sizeof(struct io_uring_cqe);
+	size_t size = sqsize > cqsize ? sqsize : cqsize;
+	char* rings = mmap(NULL, size, PROT_READ|PROT_WRITE,
+										 MAP_SHARED|MAP_POPULATE, ring, IORING_OFF_SQ_RING);
+	if(rings == MAP_FAILED) {
+		why = "couldn't map the rings";
+		goto FAIL;
+	}
+	sq.sqes = mmap(NULL, p.sq_entries * sizeof(struct io_uring_sqe),
+								 PROT_READ|PROT_WRITE, MAP_SHARED|MAP_POPULATE,
+								 ring, IORING_OFF_SQES);
+	if(sq.sqes == MAP_FAILED) {
+		why = "couldn't map the entries";
+		goto FAIL;
+	}
+	sq.head = (unsigned*)(rings + p.sq_off.head);
+	sq.tail = (unsigned*)(rings + p.sq_off.tail);
+	sq.mask = (unsigned*)(rings + p.sq_off.ring_mask);
+	sq.array = (unsigned*)(rings + p.sq_off.array);
+	sq.entries = p.sq_entries;
+	cq.head = (unsigned*)(rings + p.cq_off.head);
+	cq.tail = (unsigned*)(rings + p.cq_off.tail);
+	cq.mask = (unsigned*)(rings + p.cq_off.ring_mask);
+	cq.cqes = (struct io_uring_cqe*)(rings + p.cq_off.cqes);
+
+	if(!supported()) {
+		why = "missing operations";
+		goto FAIL;
+	}
+
+	// empty slots, for opening saved files straight into
+	int files[SLOTS];
+	int i;
+	for(i=0;i<SLOTS;++i) {
+		files[i] = -1;
+		free_slots[nfree++] = i;
+	}
+	if(0 > syscall(__NR_io_uring_register, ring,
+								 IORING_REGISTER_FILES, files, SLOTS)) {
+		why = "couldn't register files";
+		goto FAIL;
+	}
+	direct = opens_direct();
+	if(!direct) info("io_uring can't open into slots, saving without it");
+	log_wait = wait_log;
+	uring = true;
+	info("using io_uring");
+	return;
+FAIL:
+	warn("not using io_uring: %s",why);
+	close(ring);
+	ring = -1;
+}
+
+void uring_drain(void) {
+	while(nfree < SLOTS) {
+		wait_one();
+	}
+	wait_log();
+}
+
+bool uring_save(int dir, const char* name, const void* data, size_t len) {
+	if(!direct || len > sizeof(((struct save*)0)->data)) return false;
+	while(nfree == 0) {
+		wait_one();
+	}
+	struct save* save = malloc(sizeof(*save));
+	save->op.kind = SAVE;
+	save->slot = free_slots[--nfree];
+	save->left = 4;
+	memcpy(save->data,data,len);
+	save->len = len;
+	snprintf(save->temp,sizeof(save->temp),".temp-%s",name);
+	snprintf(save->name,sizeof(save->name),"%s",name);
+
+	struct io_uring_sqe* sqe = get_sqe(&save->op);
+	sqe->opcode = IORING_OP_OPENAT;
+	sqe->fd = dir;
+	sqe->addr = (uintptr_t)save->temp;
+	sqe->open_flags = O_WRONLY|O_CREAT|O_TRUNC;
+	sqe->len = 0644;
+	sqe->file_index = save->slot + 1;
+	sqe->flags = IOSQE_IO_LINK;
+
+	sqe = get_sqe(&save->op);
+	sqe->opcode = IORING_OP_WRITE;
+	sqe->fd = save->slot;
+	sqe->addr = (uintptr_t)save->data;
+	sqe->len = save->len;
+	sqe->flags = IOSQE_IO_LINK|IOSQE_FIXED_FILE;
+
+	sqe = get_sqe(&save->op);
+	sqe->opcode = IORING_OP_CLOSE;
+	sqe->file_index = save->slot + 1;
+	sqe->flags = IOSQE_IO_LINK;
+
+	sqe = get_sqe(&save->op);
+	sqe->opcode = IORING_OP_RENAMEAT;
+	sqe->fd = dir;
+	sqe->addr = (uintptr_t)save->temp;
+	sqe->len = dir;
+	sqe->addr2 = (uintptr_t)save->name;
+	return true;
+}
+
+static void unpoll(size_t i) {
+	struct io_uring_sqe* sqe = get_sqe(&cancel_op);
+	sqe->opcode = IORING_OP_POLL_REMOVE;
+	sqe->addr = (uintptr_t)polls[i].armed;
+	polls[i].armed = NULL;
+}
+
+void uring_forget(int fd) {
+	size_t i;
+	for(i=0;i<sizeof(polls)/sizeof(*polls);++i) {
+		if(polls[i].armed && polls[i].fd == fd) unpoll(i);
+	}
+}
+
+int uring_poll(struct pollfd* fds, nfds_t nfds,
+							 const struct timespec* left, const sigset_t* sigmask) {
+	assert(nfds <= sizeof(polls)/sizeof(*polls));
+	if(unsaved.failed) {
+		warn("couldn't save %s: %s",unsaved.name,strerror(unsaved.error));
+		if(unsaved.failed > 1) warn("...and %d more",unsaved.failed-1);
+		unsaved.failed = 0;
+	}
+	if(!log_op.busy) {
+		int nio = log_take(log_op.io);
+		if(nio) {
+			struct io_uring_sqe* sqe = get_sqe(&log_op.op);
+			sqe->opcode = IORING_OP_WRITEV;
+			sqe->fd = STDERR_FILENO;
+			sqe->addr = (uintptr_t)log_op.io;
+			sqe->len = nio;
+			sqe->off = -1; // append at the current position
+			log_op.busy = true;
+		}
+	}
+	nfds_t i;
+	for(i=0;i<nfds;++i) {
+		fds[i].revents = 0;
+		if(polls[i].armed) {
+			// polls stay armed between calls, until they fire
+			if(polls[i].fd == fds[i].fd && polls[i].events == fds[i].events) continue;
+			unpoll(i);
+		}
+		polls[i].revents = 0;
+		// like ppoll, negative descriptors are ignored
+		if(fds[i].fd < 0) continue;
+		polls[i].fd = fds[i].fd;
+		polls[i].events = fds[i].events;
+		polls[i].armed = malloc(sizeof(*polls[i].armed));
+		polls[i].armed->op.kind = POLL;
+		polls[i].armed->slot = i;
+		struct io_uring_sqe* sqe = get_sqe(&polls[i].armed->op);
+		sqe->opcode = IORING_OP_POLL_ADD;
+		sqe->fd = fds[i].fd;
+		sqe->poll32_events = fds[i].events;
+	}
+	timed_out = false;
+	if(timeout) {
+		// left over from a wait that a signal or poll ended
+		struct io_uring_sqe* sqe = get_sqe(&cancel_op);
+		sqe->opcode = IORING_OP_TIMEOUT_REMOVE;
+		sqe->addr = (uintptr_t)timeout;
+		timeout = NULL;
+	}
+	if(left) {
+		// the kernel copies this when it's submitted
+		static struct __kernel_timespec ts;
+		ts.tv_sec = left->tv_sec;
+		ts.tv_nsec = left->tv_nsec;
+		timeout = malloc(sizeof(*timeout));
+		timeout->kind = TIMEOUT;
+		struct io_uring_sqe* sqe = get_sqe(timeout);
+		sqe->opcode = IORING_OP_TIMEOUT;
+		sqe->addr = (uintptr_t)&ts;
+		sqe->len = 1;
+	}
+	/* submit first. If a signal interrupts a call that also submits, it returns
+		 how many it submitted instead of EINTR, and we'd never know. */
+	submit();
+	for(;;) {
+		int res = enter(0,1,sigmask);
+		if(res < 0) {
+			if(errno != EINTR) error("io_uring_enter failed");
+			return -1;
+		}
+		reap();
+		int ready = 0;
+		for(i=0;i<nfds;++i) {
+			if(polls[i].revents) {
+				fds[i].revents = polls[i].revents;
+				polls[i].revents = 0;
+				++ready;
+			}
+		}
+		if(ready || timed_out) return ready;
+	}
+}
@@ -0,0 +1,35 @@
+#ifndef URING_H
+#define URING_H
+
+#include <stdbool.h>
+#include <poll.h>
+#include <signal.h>
+#include <time.h>
+
+/* an io_uring backend for the main loop, so a burst of due rules costs a few
+	 io_uring_enter calls instead of a syscall storm. Due times (and what's
+	 kept beside them) are saved with linked openat/write/close/renameat (on
+	 kernels that can open straight into a registered slot, 5.15 and up), the
+	 log is written without blocking, and waiting for the next due time or a
+	 config change is polls plus a timeout, all submitted together when the
+	 daemon goes idle.
+
+	 Used when the kernel supports it, unless uring=0 is in the environment.
+	 Otherwise everything goes through plain syscalls and ppoll as before.
+*/
+
+extern bool uring;
+
+void uring_init(void);
+// like ppoll, but also submits everything queued up since last time
+int uring_poll(struct pollfd* fds, nfds_t nfds,
+							 const struct timespec* timeout, const sigset_t* sigmask);
+// wait for every save to finish, before exec
+void uring_drain(void);
+// fd is about to be closed, so stop polling it
+void uring_forget(int fd);
+/* write a due time (or a few bytes kept next to one) to a temp file and rename
+	 it over name. False if it has to be saved the usual way instead. */
+bool uring_save(int dir, const char* name, const void* data, size_t len);
+
+#endif /* URING_H */